@@ -0,0 +1,27 @@
+#include "BusHealth.h"
+
+namespace fujitsu_general::airstage::h {
+
+void BusHealth::update(const Counters& counters) {
+    // Counters only grow, so unsigned differences are exact even across wraparound
+    this->interval = {
+        .Frames = counters.Frames - this->last.Frames,
+        .DiscardedBytes = counters.DiscardedBytes - this->last.DiscardedBytes,
+        .FramingErrors = counters.FramingErrors - this->last.FramingErrors,
+        .Collisions = counters.Collisions - this->last.Collisions,
+        .Line = {
+            .Parity = counters.Line.Parity - this->last.Line.Parity,
+            .Framing = counters.Line.Framing - this->last.Line.Framing,
+            .Overruns = counters.Line.Overruns - this->last.Line.Overruns,
+        },
+    };
+    this->last = counters;
+
+    // Each error is assumed to have cost at most one frame
+    const uint64_t frames = this->interval.Frames;
+    const uint64_t errors = static_cast<uint64_t>(this->interval.FramingErrors) + this->interval.Collisions +
+        this->interval.Line.Parity + this->interval.Line.Framing + this->interval.Line.Overruns;
+    this->score = frames ? frames * 100 / (frames + errors) : 0;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+namespace fujitsu_general::airstage::h {
+
+// Receive errors reported by the UART (driver events on the ESP32, TIOCGICOUNT on Linux hosts)
+struct LineErrors {
+    uint32_t Parity;
+    uint32_t Framing;   // Bad stop bit or break
+    uint32_t Overruns;  // Hardware FIFO or driver buffer full; received bytes were lost
+};
+
+// Bus quality over the interval between two update() calls, from cumulative counters.
+// The score is the share of received frames that arrived without any error being seen,
+// 0 if nothing was received at all (the indoor unit transmits several frames a second).
+class BusHealth {
+    public:
+        struct Counters {
+            uint32_t Frames;
+            uint32_t DiscardedBytes;
+            uint32_t FramingErrors;  // Frames resynchronised by the controller
+            uint32_t Collisions;     // Transmitted frames whose echo differed or did not arrive
+            LineErrors Line;
+        };
+
+        void update(const Counters& counters);
+
+        // Counts over the last interval
+        const Counters& get_interval() const { return this->interval; }
+        // Percent
+        uint8_t get_score() const { return this->score; }
+
+    private:
+        Counters last {};
+        Counters interval {};
+        uint8_t score = 0;
+};
+
+}
@@ -0,0 +1,46 @@
+#include "Clock.h"
+
+namespace fujitsu_general::airstage::h {
+
+#if defined(ESP_PLATFORM)
+EspTimerClock::EspTimerClock() {
+    const esp_timer_create_args_t args = {
+        .callback = [](void* arg) {
+            auto clock = static_cast<EspTimerClock*>(arg);
+            if (clock->notify_callback)
+                clock->notify_callback();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "fujitsu_halcyon",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&args, &this->timer);
+}
+
+EspTimerClock::~EspTimerClock() {
+    if (this->timer) {
+        esp_timer_stop(this->timer);
+        esp_timer_delete(this->timer);
+    }
+}
+
+void EspTimerClock::schedule_wakeup(uint64_t time) {
+    Clock::schedule_wakeup(time);
+
+    if (this->timer) {
+        auto now = this->now();
+        esp_timer_stop(this->timer);
+        esp_timer_start_once(this->timer, time > now ? time - now : 0);
+    }
+}
+
+void EspTimerClock::cancel_wakeup() {
+    Clock::cancel_wakeup();
+
+    if (this->timer)
+        esp_timer_stop(this->timer);
+}
+#endif
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#if defined(ESP_PLATFORM)
+#include <esp_timer.h>
+#endif
+
+namespace fujitsu_general::airstage::h {
+
+// Monotonic time source with a single scheduled wakeup.
+// The wakeup callback is only ever called from dispatch(), which the owner calls from
+// its own loop, so protocol logic never runs in timer or interrupt context.
+class Clock {
+    public:
+        using WakeupCallback = std::function<void()>;
+
+        virtual ~Clock() = default;
+
+        // Monotonic time in microseconds
+        virtual uint64_t now() const = 0;
+
+        // Replaces any pending wakeup
+        virtual void schedule_wakeup(uint64_t time) { this->wakeup_time = time; this->wakeup_pending = true; }
+        virtual void cancel_wakeup() { this->wakeup_pending = false; }
+        bool is_wakeup_pending() const { return this->wakeup_pending; }
+
+        void set_wakeup_callback(WakeupCallback callback) { this->wakeup_callback = callback; }
+
+        // Calls the wakeup callback if the scheduled time has passed
+        void dispatch() {
+            if (this->wakeup_pending && this->now() >= this->wakeup_time) {
+                this->wakeup_pending = false;
+                if (this->wakeup_callback)
+                    this->wakeup_callback();
+            }
+        }
+
+    protected:
+        WakeupCallback wakeup_callback;
+        uint64_t wakeup_time = 0;
+        bool wakeup_pending = false;
+};
+
+// Real time clock for hosts, polled through dispatch()
+class SteadyClock : public Clock {
+    public:
+        uint64_t now() const override {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+};
+
+// Clock advanced manually, for deterministic replay and simulation
+class VirtualClock : public Clock {
+    public:
+        uint64_t now() const override { return this->time; }
+
+        // Moves time forward (never backwards). Wakeups that become due on the way are
+        // dispatched at their scheduled time, as with a real clock.
+        void set(uint64_t time) {
+            while (this->wakeup_pending && this->wakeup_time > this->time && this->wakeup_time <= time) {
+                this->time = this->wakeup_time;
+                this->dispatch();
+            }
+
+            if (time > this->time)
+                this->time = time;
+            this->dispatch();
+        }
+        void advance(uint64_t duration) { this->set(this->time + duration); }
+
+    private:
+        uint64_t time = 0;
+};
+
+#if defined(ESP_PLATFORM)
+// esp_timer backed clock. When a wakeup is due the notify callback is called from the
+// esp_timer task, which can be used to wake the owner's loop; the wakeup itself is still
+// delivered by dispatch().
+class EspTimerClock : public Clock {
+    public:
+        using NotifyCallback = std::function<void()>;
+
+        EspTimerClock();
+        ~EspTimerClock() override;
+
+        uint64_t now() const override { return esp_timer_get_time(); }
+        void schedule_wakeup(uint64_t time) override;
+        void cancel_wakeup() override;
+
+        void set_notify_callback(NotifyCallback callback) { this->notify_callback = callback; }
+
+    private:
+        esp_timer_handle_t timer = nullptr;
+        NotifyCallback notify_callback;
+};
+#endif
+
+}
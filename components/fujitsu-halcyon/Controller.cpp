@@ -1,63 +1,445 @@
 #include "Controller.h"
 
 #include <algorithm>
-#include <cmath>
+#include <cinttypes>
 
-//#include <esp_log.h>
-// Log through esphome instead of standard esp logging
-#include <esphome/core/log.h>
-using esphome::esp_log_printf_;
+#include "Log.h"
+#include "Trace.h"
 
 namespace fujitsu_general::airstage::h {
 
 static const char* TAG = "fujitsu_general::airstage::h::Controller";
 
 void Controller::process_uart_data() {
-    auto buffer_len = this->uart_available_bytes();
-    if (buffer_len >= Packet::FrameSize) {
-        Packet::Buffer buffer;
+    this->clock.dispatch();
+
+    const auto now = this->clock.now();
 
-        // Discard partial frame
-        if (auto discard = buffer_len % buffer.size()) {
-            this->uart_read_bytes(buffer.data(), discard);
-            ESP_LOGW(TAG, "Discarded %d bytes", discard);
+    if (auto available = this->uart_available_bytes()) {
+        auto length = std::min(available, this->rx_buffer.size() - this->rx_length);
+        this->uart_read_bytes(this->rx_buffer.data() + this->rx_length, length);
+        this->rx_length += length;
+        this->rx_time = now;
+    }
+    else if (this->rx_length && now - this->rx_time > FrameGapTimeout) {
+        // After a gap the buffer ends on a frame boundary. Frames held back until then are
+        // resynchronised to it, and nothing will complete a partial frame.
+        this->process_rx_buffer(now, true);
+        if (this->rx_length) {
+            this->statistics.FramingErrors++;
+            this->discard_rx_bytes(this->rx_length);
         }
+    }
+
+    this->process_rx_buffer(now, false);
+}
 
-        // For each frame
-        while (buffer_len) {
-            this->uart_read_bytes(buffer.data(), buffer.size());
-            buffer_len = this->uart_available_bytes();
-            this->process_packet(buffer, buffer_len == 0 /* Indicates final packet on wire */);
+void Controller::process_rx_buffer(uint64_t now, bool burst_ended) {
+    while (this->rx_length >= Packet::FrameSize) {
+        if (!Packet::is_plausible(this->rx_buffer.data())) {
+            // Reads may end mid-frame, so the end of the buffer is only known to be a frame
+            // boundary once the gap after it arrives. Wait for it unless the buffer is full.
+            if (!burst_ended && this->rx_length < this->rx_buffer.size())
+                break;
+
+            this->statistics.FramingErrors++;
+            this->discard_rx_bytes(this->find_frame(burst_ended));
+            if (this->rx_length < Packet::FrameSize)
+                break;
         }
+
+        Packet::Buffer buffer;
+        std::copy_n(this->rx_buffer.begin(), buffer.size(), buffer.begin());
+        std::copy(this->rx_buffer.begin() + buffer.size(), this->rx_buffer.begin() + this->rx_length, this->rx_buffer.begin());
+        this->rx_length -= buffer.size();
+
+        if (this->echo_pending && this->verify_echo(buffer))
+            continue;
+
+        if (this->callbacks.Frame)
+            this->callbacks.Frame(buffer);
+
+        this->frame_time = now;
+        this->process_packet(buffer, this->rx_length < Packet::FrameSize && this->uart_available_bytes() == 0 /* Indicates final packet on wire */);
+    }
+}
+
+// The first frame after we transmit is our own echo, unless it differs and arrives too late to be.
+// rx_time is when the bytes were read, so an intact echo is late only because the loop was; it must
+// not reach process_packet(), which would take our own frame for an address conflict.
+// Returns true if the frame was consumed as the echo, intact or not.
+bool Controller::verify_echo(const Packet::Buffer& buffer) {
+    this->echo_pending = false;
+
+    if (buffer == this->echo_frame) {
+        if (this->rx_time > this->echo_deadline)
+            this->statistics.LateEchoes++;
+        return true;
+    }
+
+    if (this->rx_time > this->echo_deadline) {
+        ESP_LOGW(TAG, "No echo of transmitted frame");
+        this->on_collision();
+        return false;
+    }
+
+    // Another transmitter overlapped ours; log what the bus carried
+    ESP_LOGW(TAG, "Echo differs from transmitted frame");
+    if (this->callbacks.Frame)
+        this->callbacks.Frame(buffer);
+    this->on_collision();
+    return true;
+}
+
+// Undo what sending the lost frame completed, so the scheduler picks it again
+void Controller::on_collision() {
+    this->statistics.Collisions++;
+
+    switch (this->echo_slot) {
+        case SlotEnum::Error:
+            this->resend_error = true;
+            break;
+
+        case SlotEnum::Features:
+            if (this->initialization_stage == InitializationStageEnum::FeatureRequestRx)
+                this->set_initialization_stage(InitializationStageEnum::FeatureRequestTx);
+            break;
+
+        case SlotEnum::ConfigWrite:
+            for (size_t field = 0; field < SettableFields::MAX; field++)
+                if (this->echo_changes[field])
+                    this->change(field);
+            if (this->echo_reset_filter_timer)
+                this->changed_configuration.Controller.ResetFilterTimer = true;
+            if (this->echo_maintenance)
+                this->changed_configuration.Controller.Maintenance = true;
+            break;
+
+        case SlotEnum::Function:
+            for (auto& request : this->function_requests) {
+                if (request.Sent && request.Function.Function == this->echo_function.Function && request.Function.Unit == this->echo_function.Unit) {
+                    request.Sent = false;
+                    request.Attempts--;
+                    break;
+                }
+            }
+            this->update_wakeup();
+            break;
+
+        case SlotEnum::Config:
+            // Sent in every slot with nothing else pending anyway
+            break;
     }
 }
 
+// Offset of the first frame in a misaligned receive buffer. At the end of a burst, frames aligned to
+// the end of the buffer are preferred; otherwise, and failing that, the first plausible frame is used.
+// With nothing plausible, all but a possible partial frame is dropped.
+size_t Controller::find_frame(bool burst_ended) const {
+    const auto last = this->rx_length - Packet::FrameSize;
+
+    if (burst_ended)
+        for (auto offset = this->rx_length % Packet::FrameSize; offset <= last; offset += Packet::FrameSize)
+            if (Packet::is_plausible(&this->rx_buffer[offset]))
+                return offset;
+
+    for (size_t offset = 1; offset <= last; offset++)
+        if (Packet::is_plausible(&this->rx_buffer[offset]))
+            return offset;
+
+    return last + 1;
+}
+
+void Controller::discard_rx_bytes(size_t count) {
+    ESP_LOGW(TAG, "Discarded %zu bytes", count);
+    this->statistics.DiscardedBytes += count;
+    std::copy(this->rx_buffer.begin() + count, this->rx_buffer.begin() + this->rx_length, this->rx_buffer.begin());
+    this->rx_length -= count;
+}
+
 size_t Controller::uart_available_bytes() {
     return this->callbacks.AvailableBytes ? callbacks.AvailableBytes() : 0;
 }
 
 void Controller::uart_read_bytes(uint8_t *buf, size_t length) {
+    FUJITSU_HALCYON_TRACE(Read);
     if (this->callbacks.ReadBytes)
         callbacks.ReadBytes(buf, length);
 }
 
 void Controller::uart_write_bytes(const uint8_t *buf, size_t length) {
+    FUJITSU_HALCYON_TRACE(Write);
     if (this->callbacks.WriteBytes)
         callbacks.WriteBytes(buf, length);
 }
 
 void Controller::set_initialization_stage(const InitializationStageEnum stage) {
     this->initialization_stage = stage;
+    this->stage_time = this->clock.now();
+
+    if (stage == InitializationStageEnum::Complete) {
+        this->features_known = true;
+
+        if (this->resuming) {
+            this->resuming = false;
+            this->statistics.SilenceRecoverTime = (this->stage_time - this->resume_time) / 1000;
+            ESP_LOGI(TAG, "Rejoined %" PRIu32 " ms after bus activity resumed", this->statistics.SilenceRecoverTime);
+        }
+    }
+
+    this->update_wakeup();
+
     if (this->callbacks.InitializationStage)
         callbacks.InitializationStage(stage);
 }
 
+void Controller::reinitialize() {
+    this->features_known = false;
+
+    if (this->auto_address)
+        this->start_discovery();
+
+    this->set_initialization_stage(InitializationStageEnum::DetectFeatureSupport);
+}
+
+void Controller::set_auto_address(bool auto_address) {
+    this->auto_address = auto_address;
+    this->discovering = false;
+
+    if (auto_address)
+        this->start_discovery();
+}
+
+void Controller::start_discovery() {
+    // Nothing to claim without transmitting
+    if (this->listen_only)
+        return;
+
+    this->discovering = true;
+    this->discovery_rotations = 0;
+    this->discovered_addresses.reset();
+}
+
+void Controller::discover(const Packet& packet) {
+    // Secondary controllers only receive the token from the preceding address
+    auto first_free_address = [this]() {
+        uint8_t address = 0;
+        while (address <= MaxAddress && this->discovered_addresses[address])
+            address++;
+        return address;
+    };
+
+    if (packet.SourceType == AddressTypeEnum::Controller) {
+        this->discovered_addresses.set(packet.SourceAddress);
+
+        // After a full rotation every controller in the chain has been seen, so a token passed to the
+        // first free address is the preceding controller probing for a new one. It may not probe again.
+        if (this->discovery_rotations >= 2 && packet.TokenDestinationType == AddressTypeEnum::Controller &&
+            packet.TokenDestinationAddress == first_free_address())
+            this->claim_address(packet.TokenDestinationAddress);
+        return;
+    }
+
+    // Each indoor unit frame starts a rotation
+    if (++this->discovery_rotations < DiscoveryRotations)
+        return;
+
+    if (auto address = first_free_address(); address <= MaxAddress)
+        this->claim_address(address);
+    else {
+        ESP_LOGW(TAG, "No free controller address, listening again");
+        this->start_discovery();
+    }
+}
+
+// Claiming transmits in the slot that picked the address, without a further rotation of watching: the
+// address went unheard for at least two rotations before, and a probe by the preceding controller is not
+// repeated, so it must be answered at once. A controller turning up with the address later is a conflict.
+void Controller::claim_address(uint8_t address) {
+    ESP_LOGI(TAG, "Claiming controller address %u", address);
+    this->controller_address = address;
+    this->discovering = false;
+    this->config_frame_dirty = true;
+}
+
+// Stages after DetectFeatureSupport each complete within a rotation or two
+static bool is_initialization_timed(InitializationStageEnum stage) {
+    return stage != InitializationStageEnum::DetectFeatureSupport && stage != InitializationStageEnum::Complete;
+}
+
+void Controller::on_silence(uint64_t now) {
+    if (!this->silent) {
+        this->silent = true;
+        this->resuming = false;
+        this->statistics.BusSilences++;
+        this->statistics.SilenceDetectTime = (now - this->watchdog_time) / 1000;
+        ESP_LOGW(TAG, "No frames for %" PRIu32 " ms, resetting transport", this->statistics.SilenceDetectTime);
+
+        if (this->initialization_stage != InitializationStageEnum::DetectFeatureSupport)
+            this->set_initialization_stage(InitializationStageEnum::DetectFeatureSupport);
+    }
+
+    // Keep resetting while the silence lasts; anything buffered, an echo included, is discarded
+    this->watchdog_time = now;
+    this->echo_pending = false;
+    if (this->callbacks.ResetTransport)
+        this->callbacks.ResetTransport();
+}
+
+void Controller::on_wakeup() {
+    const auto now = this->clock.now();
+
+    if (now - this->watchdog_time >= SilenceTimeout)
+        this->on_silence(now);
+
+    if (is_initialization_timed(this->initialization_stage) && now - this->stage_time >= InitializationTimeout) {
+        ESP_LOGW(TAG, "Initialization timed out in stage %u, restarting", static_cast<unsigned>(this->initialization_stage));
+        this->statistics.InitializationTimeouts++;
+        this->reinitialize();
+    }
+
+    for (auto it = this->function_requests.begin(); it != this->function_requests.end();) {
+        if (!it->Sent || now < it->Deadline)
+            ++it;
+        else if (it->Attempts < FunctionAttempts) {
+            ESP_LOGD(TAG, "Function %u unit %u timed out, retrying", it->Function.Function, it->Function.Unit);
+            it->Sent = false;
+            ++it;
+        }
+        else {
+            ESP_LOGW(TAG, "Function %u unit %u failed after %u attempts", it->Function.Function, it->Function.Unit, it->Attempts);
+            auto failed = std::move(*it);
+            this->function_requests.erase(it);
+
+            // Callbacks may queue new requests, so call them after the queue is updated and start over
+            if (failed.Callback)
+                failed.Callback(false, failed.Function);
+            it = this->function_requests.begin();
+        }
+    }
+
+    this->update_wakeup();
+}
+
+// The clock holds a single wakeup, so schedule it for the earliest deadline
+void Controller::update_wakeup() {
+    // Not moved on every frame; an early wakeup finds the bus alive and reschedules
+    auto wakeup = this->watchdog_time + SilenceTimeout;
+
+    if (is_initialization_timed(this->initialization_stage))
+        wakeup = std::min(wakeup, this->stage_time + InitializationTimeout);
+
+    for (auto& request : this->function_requests)
+        if (request.Sent)
+            wakeup = std::min(wakeup, request.Deadline);
+
+    this->clock.schedule_wakeup(wakeup);
+}
+
+void Controller::queue_function(const struct Function& function, FunctionResultCallback callback) {
+    if (this->listen_only) {
+        if (callback)
+            callback(false, function);
+        return;
+    }
+
+    if (this->function_requests.full()) {
+        ESP_LOGW(TAG, "Function %u unit %u not queued, %zu requests pending", function.Function, function.Unit, this->function_requests.size());
+        if (callback)
+            callback(false, function);
+        return;
+    }
+
+    this->function_requests.push_back({ .Function = function, .Callback = std::move(callback), .Attempts = 0, .Sent = false, .Queued = this->clock.now(), .Deadline = 0 });
+}
+
+Controller::FunctionRequest* Controller::next_function_request() {
+    auto awaiting_reply = [this](const FunctionRequest& request) {
+        return std::any_of(this->function_requests.begin(), this->function_requests.end(), [&request](const FunctionRequest& other) {
+            return other.Sent && other.Function.Function == request.Function.Function && other.Function.Unit == request.Function.Unit;
+        });
+    };
+
+    return std::find_if(this->function_requests.begin(), this->function_requests.end(), [&](const FunctionRequest& request) {
+        return !request.Sent && !awaiting_reply(request);
+    });
+}
+
+Controller::FunctionResultCallback Controller::complete_function_request(const struct Function& reply) {
+    auto it = std::find_if(this->function_requests.begin(), this->function_requests.end(), [&reply](const FunctionRequest& request) {
+        return request.Sent && request.Function.Function == reply.Function && request.Function.Unit == reply.Unit;
+    });
+
+    if (it == this->function_requests.end())
+        return {};
+
+    auto callback = std::move(it->Callback);
+    this->function_requests.erase(it);
+    this->update_wakeup();
+    return callback;
+}
+
+// Earliest deadline first. Writes are due as soon as they are requested, and the next function request
+// once it has waited FunctionYield, so a write waits at most one slot for an overdue function and
+// a stream of writes cannot hold function requests back for longer than FunctionYield.
+Controller::SlotEnum Controller::schedule_slot(bool acknowledge_error, const FunctionRequest* request) const {
+    struct Candidate {
+        SlotEnum Slot;
+        uint64_t Deadline;
+    };
+
+    std::array<Candidate, 5> candidates;
+    size_t count = 0;
+
+    if (acknowledge_error)
+        candidates[count++] = { SlotEnum::Error, 0 };
+    if (this->autoconf && this->initialization_stage == InitializationStageEnum::FeatureRequestTx)
+        candidates[count++] = { SlotEnum::Features, 0 };
+    if (this->configuration_changes.any())
+        candidates[count++] = { SlotEnum::ConfigWrite, this->change_time };
+    if (request != this->function_requests.end())
+        candidates[count++] = { SlotEnum::Function, std::max(request->Queued, this->function_slot_time) + FunctionYield };
+    candidates[count++] = { SlotEnum::Config, UINT64_MAX };
+
+    return std::min_element(candidates.begin(), candidates.begin() + count, [](const Candidate& a, const Candidate& b) {
+        return a.Deadline != b.Deadline ? a.Deadline < b.Deadline : a.Slot < b.Slot;
+    })->Slot;
+}
+
 void Controller::process_packet(const Packet::Buffer& buffer, bool lastPacketOnWire) {
     bool error_flag_changed = false;
-    std::function<void()> deferred_callback;
+    InplaceFunction<void(), sizeof(FunctionResultCallback) + 2 * sizeof(void*)> deferred_callback;
 
     // Parse buffer
+    FUJITSU_HALCYON_TRACE_BEGIN(Decode);
     Packet packet(buffer);
+    FUJITSU_HALCYON_TRACE_END(Decode);
+
+    this->statistics.RxFrames++;
+    if (this->unknown_bits)
+        this->unknown_bits->update(buffer);
+    this->watchdog_time = this->frame_time;
+    if (this->silent) {
+        this->silent = false;
+        this->resuming = true;
+        this->resume_time = this->frame_time;
+        ESP_LOGI(TAG, "Bus activity resumed");
+    }
+
+    auto& frames = packet.SourceType == AddressTypeEnum::IndoorUnit ? this->statistics.IndoorUnitFrames : this->statistics.ControllerFrames;
+    if (auto type = static_cast<size_t>(packet.Type); type < frames.size())
+        frames[type]++;
+
+    if (this->discovering)
+        this->discover(packet);
+    else if (!this->listen_only && packet.SourceType == AddressTypeEnum::Controller && packet.SourceAddress == this->controller_address) {
+        // Every frame conflicts while it lasts, so only log occasionally
+        if (this->statistics.AddressConflicts++ % 100 == 0)
+            ESP_LOGW(TAG, "Another controller is using address %u", this->controller_address);
+
+        if (this->auto_address)
+            this->reinitialize();
+    }
 
     // Finish initialization
     if (this->initialization_stage == InitializationStageEnum::FindNextControllerRx) {
@@ -73,22 +455,29 @@ void Controller::process_packet(const Packet::Buffer& buffer, bool lastPacketOnW
     if (packet.SourceType == AddressTypeEnum::IndoorUnit) {
         switch (packet.Type) {
             [[likely]] case PacketTypeEnum::Config:
-                if (this->initialization_stage == InitializationStageEnum::DetectFeatureSupport) {
+                if (this->listen_only) {
+                    // Nothing to negotiate without transmitting; features come from
+                    // the configured defaults or from a Features reply to another controller.
+                    if (this->initialization_stage != InitializationStageEnum::Complete)
+                        this->set_initialization_stage(InitializationStageEnum::Complete);
+                }
+                else if (this->initialization_stage == InitializationStageEnum::DetectFeatureSupport && !this->discovering) {
                     // Advance to FindNextControllerTx (skip feature negotiation entirely) if:
                     //  - autoconf is disabled (use the configured features directly), or
+                    //  - features were negotiated before a bus silence (rejoin quickly), or
                     //  - the IU's UnknownFlags == 2 (no feature negotiation support).
                     // Otherwise, transition to FeatureRequestTx to send a FeatureRequest packet
                     // when our turn with the token comes around. The actual transmission and
                     // the subsequent transition to FeatureRequestRx happen later in this function.
                     // Note: this->features is already initialized to DefaultFeatures (or to a
                     // user-supplied override via set_features()), so no assignment is needed here.
-                    if (!this->autoconf ||
+                    if (!this->autoconf || this->features_known ||
                         packet.Config.IndoorUnit.UnknownFlags == 2) {
                         this->set_initialization_stage(InitializationStageEnum::FindNextControllerTx);
                     } else
                         this->set_initialization_stage(InitializationStageEnum::FeatureRequestTx);
                 }
-                else if (this->initialization_stage == InitializationStageEnum::FeatureRequestRx) {
+                else if (this->autoconf && this->initialization_stage == InitializationStageEnum::FeatureRequestRx) {
                     // We already transmitted a FeatureRequest and the IU replied with another
                     // Config instead of a Features packet -> the IU does not support feature
                     // negotiation. Fall back to the in-code (or user-supplied) defaults already
@@ -99,6 +488,11 @@ void Controller::process_packet(const Packet::Buffer& buffer, bool lastPacketOnW
                 if (this->last_error_flag != packet.Config.IndoorUnit.Error)
                     error_flag_changed = true;
 
+                if (buffer != this->indoor_unit_config_frame) {
+                    this->indoor_unit_config_frame = buffer;
+                    this->config_frame_dirty = true;
+                }
+
                 this->last_error_flag = packet.Config.IndoorUnit.Error;
                 this->current_configuration = packet.Config;
 
@@ -116,18 +510,28 @@ void Controller::process_packet(const Packet::Buffer& buffer, bool lastPacketOnW
                 break;
 
             case PacketTypeEnum::Features:
+                // Fixed features are never requested, and a reply to another controller does not replace them
+#if !defined(FUJITSU_HALCYON_FEATURES)
                 this->features = packet.Features;
-                this->set_initialization_stage(InitializationStageEnum::FindNextControllerTx);
+                if (!this->listen_only)
+                    this->set_initialization_stage(InitializationStageEnum::FindNextControllerTx);
+#endif
                 break;
 
             case PacketTypeEnum::Function:
-                if (this->callbacks.Function)
-                    deferred_callback = [&](){ this->callbacks.Function(packet.Function); };
+                deferred_callback = [this, &packet, completed = this->complete_function_request(packet.Function)](){
+                    if (this->callbacks.Function)
+                        this->callbacks.Function(packet.Function);
+                    if (completed)
+                        completed(true, packet.Function);
+                };
                 break;
             case PacketTypeEnum::Status:
                 break;
         }
     } else {
+        this->topology.update(packet, this->frame_time);
+
         switch (packet.Type) {
             // Config packet from another controller
             [[likely]] case PacketTypeEnum::Config:
@@ -140,191 +544,270 @@ void Controller::process_packet(const Packet::Buffer& buffer, bool lastPacketOnW
     }
 
     // Emit a packet if given the token and not processing old packets
-    if (lastPacketOnWire && packet.TokenDestinationType == AddressTypeEnum::Controller && packet.TokenDestinationAddress == this->controller_address) {
-        Packet tx_packet;
-        tx_packet.SourceType = AddressTypeEnum::Controller;
-        tx_packet.SourceAddress = this->controller_address;
-
+    const bool have_token = !this->listen_only && !this->discovering && lastPacketOnWire &&
+        packet.TokenDestinationType == AddressTypeEnum::Controller && packet.TokenDestinationAddress == this->controller_address;
+
+    // Too late to respond without risking a collision; skip this rotation leaving all pending state in place.
+    // frame_time is when the frame was read, not when it ended on the wire, so this mostly catches slow processing.
+    // Need to use RX_TIMEOUT interrupt to get accurate rx timestamp? Can drop lastPacketOnWire check if implemented
+    if (have_token && this->clock.now() - this->frame_time > MaxTxDelay) {
+        this->statistics.MissedWindows++;
+        ESP_LOGW(TAG, "Missed transmit window");
+    }
+    else if (have_token) {
         if (this->initialization_stage == InitializationStageEnum::FindNextControllerTx) {
             this->next_token_destination_type = AddressTypeEnum::Controller;
             this->set_initialization_stage(InitializationStageEnum::FindNextControllerRx);
         }
 
-        tx_packet.TokenDestinationType = this->next_token_destination_type;
-        tx_packet.TokenDestinationAddress = this->next_token_destination_type == AddressTypeEnum::Controller ? this->controller_address + 1 : 1;
-
-        if ((error_flag_changed && this->is_primary_controller()) ||
-            (packet.Type == PacketTypeEnum::Error && !this->is_primary_controller()))
-            tx_packet.Type = PacketTypeEnum::Error;
-        else if (this->initialization_stage == InitializationStageEnum::FeatureRequestTx) {
-            tx_packet.Type = PacketTypeEnum::Features;
-            // Advance only after the request is actually transmitted, mirroring
-            // the FindNextControllerTx -> FindNextControllerRx transition above.
-            this->set_initialization_stage(InitializationStageEnum::FeatureRequestRx);
-        }
-        else if (!this->function_queue.empty()) {
-            tx_packet.Type = PacketTypeEnum::Function;
-            tx_packet.Function = this->function_queue.front();
-            this->function_queue.pop();
-        }
-        else {
-            // First CONFIG packet sent from Fujitsu controller has write flag set, but we do not restore state at this time
-            tx_packet.Type = PacketTypeEnum::Config;
-            tx_packet.Config = this->current_configuration;
-            tx_packet.Config.Controller.Temperature = this->changed_configuration.Controller.Temperature;
-            tx_packet.Config.Controller.UseControllerSensor = this->changed_configuration.Controller.UseControllerSensor;
-
-            if (this->configuration_changes.any()) {
-                tx_packet.Config.Controller.Write = true;
-
-                // Overwrite fields received from Indoor Unit
-                if (this->configuration_changes[SettableFields::Enabled])
-                    tx_packet.Config.Enabled = this->changed_configuration.Enabled;
-
-                if (this->configuration_changes[SettableFields::Economy])
-                    tx_packet.Config.Economy = this->changed_configuration.Economy;
-
-                if (this->configuration_changes[SettableFields::Setpoint])
-                    tx_packet.Config.Setpoint = this->changed_configuration.Setpoint;
+        const auto token_destination_address = this->next_token_destination_type == AddressTypeEnum::Controller ? this->controller_address + 1 : 1;
 
-                if (this->configuration_changes[SettableFields::TestRun])
-                    tx_packet.Config.TestRun = this->changed_configuration.TestRun;
+        const bool acknowledge_error = (error_flag_changed && this->is_primary_controller()) ||
+            (packet.Type == PacketTypeEnum::Error && !this->is_primary_controller()) || this->resend_error;
+        const auto request = this->next_function_request();
 
-                if (this->configuration_changes[SettableFields::Mode])
-                    tx_packet.Config.Mode = this->changed_configuration.Mode;
+        Packet::Buffer b;
+        const auto slot = this->schedule_slot(acknowledge_error, request);
+        if (slot == SlotEnum::Config || slot == SlotEnum::ConfigWrite) {
+            // First CONFIG packet sent from Fujitsu controller has write flag set, but we do not restore state at this time
+            if (this->config_frame_dirty)
+                this->build_config_frame();
 
-                if (this->configuration_changes[SettableFields::FanSpeed])
-                    tx_packet.Config.FanSpeed = this->changed_configuration.FanSpeed;
+            b = this->config_frame;
+            Packet::set_token_destination(b, this->next_token_destination_type, token_destination_address);
+        }
+        else {
+            Packet tx_packet;
+            tx_packet.SourceType = AddressTypeEnum::Controller;
+            tx_packet.SourceAddress = this->controller_address;
+            tx_packet.TokenDestinationType = this->next_token_destination_type;
+            tx_packet.TokenDestinationAddress = token_destination_address;
+
+            if (slot == SlotEnum::Error) {
+                tx_packet.Type = PacketTypeEnum::Error;
+                this->resend_error = false;
+            }
+            else if (slot == SlotEnum::Features) {
+                tx_packet.Type = PacketTypeEnum::Features;
+                // Advance only after the request is actually transmitted, mirroring
+                // the FindNextControllerTx -> FindNextControllerRx transition above.
+                this->set_initialization_stage(InitializationStageEnum::FeatureRequestRx);
+            }
+            else {
+                tx_packet.Type = PacketTypeEnum::Function;
+                tx_packet.Function = request->Function;
+                request->Sent = true;
+                request->Attempts++;
+                request->Deadline = this->clock.now() + FunctionTimeout;
+                this->function_slot_time = this->clock.now();
+                this->update_wakeup();
+                this->echo_function = request->Function;
+            }
 
-                if (this->configuration_changes[SettableFields::SwingVertical])
-                    tx_packet.Config.SwingVertical = this->changed_configuration.SwingVertical;
+            FUJITSU_HALCYON_TRACE_BEGIN(Encode);
+            b = tx_packet.to_buffer();
+            FUJITSU_HALCYON_TRACE_END(Encode);
+        }
 
-                if (this->configuration_changes[SettableFields::SwingHorizontal])
-                    tx_packet.Config.SwingHorizontal = this->changed_configuration.SwingHorizontal;
+        this->uart_write_bytes(b.data(), b.size());
+        this->statistics.TxFrames++;
 
-                // Set fields not returned from Indoor Unit
-                if (this->configuration_changes[SettableFields::AdvanceVerticalLouver])
-                    tx_packet.Config.Controller.AdvanceVerticalLouver = this->changed_configuration.Controller.AdvanceVerticalLouver;
+        if (this->echo_verification) {
+            this->echo_pending = true;
+            this->echo_deadline = this->clock.now() + EchoTimeout;
+            this->echo_frame = b;
+            this->echo_slot = slot;
+        }
 
-                if (this->configuration_changes[SettableFields::AdvanceHorizontalLouver])
-                    tx_packet.Config.Controller.AdvanceHorizontalLouver = this->changed_configuration.Controller.AdvanceHorizontalLouver;
+        if (slot == SlotEnum::ConfigWrite) {
+            // Some fields need to be written clear in next tx packet
+            const bool reset_filter_timer = this->configuration_changes[SettableFields::ResetFilterTimer] && this->changed_configuration.Controller.ResetFilterTimer;
+            const bool maintenance = this->configuration_changes[SettableFields::Maintenance] && this->changed_configuration.Controller.Maintenance;
 
-                if (this->configuration_changes[SettableFields::ResetFilterTimer])
-                    tx_packet.Config.Controller.ResetFilterTimer = this->changed_configuration.Controller.ResetFilterTimer;
-
-                if (this->configuration_changes[SettableFields::Maintenance])
-                    tx_packet.Config.Controller.Maintenance = this->changed_configuration.Controller.Maintenance;
-            }
+            this->echo_changes = this->configuration_changes;
+            this->echo_reset_filter_timer = reset_filter_timer;
+            this->echo_maintenance = maintenance;
 
             this->configuration_changes.reset();
+            this->config_frame_dirty = true;
 
-            // Some fields need to be written clear in next tx packet
-            if (tx_packet.Config.Controller.ResetFilterTimer) {
+            if (reset_filter_timer) {
                 this->changed_configuration.Controller.ResetFilterTimer = false;
-                this->configuration_changes[SettableFields::ResetFilterTimer] = true;
+                this->change(SettableFields::ResetFilterTimer);
             }
 
-            if (tx_packet.Config.Controller.Maintenance) {
+            if (maintenance) {
                 this->changed_configuration.Controller.Maintenance = false;
-                this->configuration_changes[SettableFields::Maintenance] = true;
+                this->change(SettableFields::Maintenance);
             }
         }
-
-        Packet::Buffer b = tx_packet.to_buffer();
-        // TODO Should check have not missed tx window before tx...
-        // Need to use RX_TIMEOUT interrupt to get accurate rx timestamp?
-        // Can drop lastPacketOnWire check if implemented
-        this->uart_write_bytes(b.data(), b.size());
     }
 
     // Have now (hopefully) transmitted on time so call pending callback
     if (deferred_callback) {
+        FUJITSU_HALCYON_TRACE(Callback);
         deferred_callback();
     }
+
+    // Ready for the next token
+    if (this->config_frame_dirty && !this->listen_only)
+        this->build_config_frame();
 }
 
-void Controller::set_current_temperature(float temperature) {
-    this->changed_configuration.Controller.Temperature = std::clamp(std::isfinite(temperature) ? temperature : 0, MinTemperature, MaxTemperature);
+// Our Config frame, from the last state reported by the indoor unit with pending changes applied
+void Controller::build_config_frame() {
+    FUJITSU_HALCYON_TRACE_BEGIN(Merge);
+    Packet tx_packet;
+    tx_packet.SourceType = AddressTypeEnum::Controller;
+    tx_packet.SourceAddress = this->controller_address;
+    tx_packet.Type = PacketTypeEnum::Config;
+    tx_packet.Config = this->current_configuration;
+    tx_packet.Config.Controller.Temperature = this->changed_configuration.Controller.Temperature;
+    tx_packet.Config.Controller.UseControllerSensor = this->changed_configuration.Controller.UseControllerSensor;
+
+    if (this->configuration_changes.any()) {
+        tx_packet.Config.Controller.Write = true;
+
+        // Overwrite fields received from Indoor Unit
+        if (this->configuration_changes[SettableFields::Enabled])
+            tx_packet.Config.Enabled = this->changed_configuration.Enabled;
+
+        if (this->configuration_changes[SettableFields::Economy])
+            tx_packet.Config.Economy = this->changed_configuration.Economy;
+
+        if (this->configuration_changes[SettableFields::Setpoint])
+            tx_packet.Config.Setpoint = this->changed_configuration.Setpoint;
+
+        if (this->configuration_changes[SettableFields::TestRun])
+            tx_packet.Config.TestRun = this->changed_configuration.TestRun;
+
+        if (this->configuration_changes[SettableFields::Mode])
+            tx_packet.Config.Mode = this->changed_configuration.Mode;
+
+        if (this->configuration_changes[SettableFields::FanSpeed])
+            tx_packet.Config.FanSpeed = this->changed_configuration.FanSpeed;
+
+        if (this->configuration_changes[SettableFields::SwingVertical])
+            tx_packet.Config.SwingVertical = this->changed_configuration.SwingVertical;
+
+        if (this->configuration_changes[SettableFields::SwingHorizontal])
+            tx_packet.Config.SwingHorizontal = this->changed_configuration.SwingHorizontal;
+
+        // Set fields not returned from Indoor Unit
+        if (this->configuration_changes[SettableFields::AdvanceVerticalLouver])
+            tx_packet.Config.Controller.AdvanceVerticalLouver = this->changed_configuration.Controller.AdvanceVerticalLouver;
+
+        if (this->configuration_changes[SettableFields::AdvanceHorizontalLouver])
+            tx_packet.Config.Controller.AdvanceHorizontalLouver = this->changed_configuration.Controller.AdvanceHorizontalLouver;
+
+        if (this->configuration_changes[SettableFields::ResetFilterTimer])
+            tx_packet.Config.Controller.ResetFilterTimer = this->changed_configuration.Controller.ResetFilterTimer;
+
+        if (this->configuration_changes[SettableFields::Maintenance])
+            tx_packet.Config.Controller.Maintenance = this->changed_configuration.Controller.Maintenance;
+    }
+    FUJITSU_HALCYON_TRACE_END(Merge);
+
+    FUJITSU_HALCYON_TRACE_BEGIN(Encode);
+    this->config_frame = tx_packet.to_buffer();
+    FUJITSU_HALCYON_TRACE_END(Encode);
+    this->config_frame_dirty = false;
+}
+
+bool Controller::is_writable(bool ignore_lock, bool lock) const {
+    if (this->listen_only)
+        return false;
+
+    return ignore_lock || !(this->current_configuration.IndoorUnit.Lock.All || lock);
+}
+
+void Controller::change(size_t field) {
+    if (this->configuration_changes.none())
+        this->change_time = this->clock.now();
+    this->configuration_changes[field] = true;
+    this->config_frame_dirty = true;
+}
+
+void Controller::set_current_temperature(HalfDegrees temperature) {
+    this->changed_configuration.Controller.Temperature = { std::min(temperature.Steps, MaxTemperature.Steps) };
     // Do not set configuration_changed flag - does not require write bit set
+    this->config_frame_dirty = true;
 }
 
 bool Controller::set_enabled(bool enabled, bool ignore_lock) {
-    if (!ignore_lock && (this->current_configuration.IndoorUnit.Lock.All || this->current_configuration.IndoorUnit.Lock.Enabled))
+    if (!this->is_writable(ignore_lock, this->current_configuration.IndoorUnit.Lock.Enabled))
         return false;
 
     this->changed_configuration.Enabled = enabled;
-    this->configuration_changes[SettableFields::Enabled] = true;
+    this->change(SettableFields::Enabled);
     return true;
 }
 
 bool Controller::set_economy(bool economy, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     this->changed_configuration.Economy = economy;
-    this->configuration_changes[SettableFields::Economy] = true;
+    this->change(SettableFields::Economy);
     return true;
 }
 
 bool Controller::set_test_run(bool test_run, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     this->changed_configuration.TestRun = test_run;
-    this->configuration_changes[SettableFields::TestRun] = true;
+    this->change(SettableFields::TestRun);
     return true;
 }
 
 bool Controller::set_setpoint(uint8_t temperature, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (temperature < MinSetpoint || temperature > MaxSetpoint)
         return false;
 
     this->changed_configuration.Setpoint = temperature;
-    this->configuration_changes[SettableFields::Setpoint] = true;
+    this->change(SettableFields::Setpoint);
     return true;
 }
 
-bool Controller::set_mode(ModeEnum mode, bool ignore_lock) {
-    if (!ignore_lock && (this->current_configuration.IndoorUnit.Lock.All || this->current_configuration.IndoorUnit.Lock.Mode))
+bool Controller::can_set_mode(ModeEnum mode, bool ignore_lock) const {
+    if (!this->is_writable(ignore_lock, this->current_configuration.IndoorUnit.Lock.Mode))
         return false;
 
     switch (mode) {
         case ModeEnum::Fan:
-            if (!this->features.Mode.Fan)
-                return false;
-            break;
+            return this->features.Mode.Fan;
 
         case ModeEnum::Dry:
-            if (!this->features.Mode.Dry)
-                return false;
-            break;
+            return this->features.Mode.Dry;
 
         case ModeEnum::Cool:
-            if (!this->features.Mode.Cool)
-                return false;
-            break;
+            return this->features.Mode.Cool;
 
         case ModeEnum::Heat:
-            if (!this->features.Mode.Heat)
-                return false;
-            break;
+            return this->features.Mode.Heat;
 
         case ModeEnum::Auto:
-            if (!this->features.Mode.Auto)
-                return false;
-            break;
+            return this->features.Mode.Auto;
     }
 
+    return true;
+}
+
+bool Controller::set_mode(ModeEnum mode, bool ignore_lock) {
+    if (!this->can_set_mode(mode, ignore_lock))
+        return false;
+
     this->changed_configuration.Mode = mode;
-    this->configuration_changes[SettableFields::Mode] = true;
+    this->change(SettableFields::Mode);
     return true;
 }
 
 bool Controller::set_fan_speed(FanSpeedEnum fan_speed, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     switch (fan_speed) {
@@ -355,60 +838,60 @@ bool Controller::set_fan_speed(FanSpeedEnum fan_speed, bool ignore_lock) {
     }
 
     this->changed_configuration.FanSpeed = fan_speed;
-    this->configuration_changes[SettableFields::FanSpeed] = true;
+    this->change(SettableFields::FanSpeed);
     return true;
 }
 
 bool Controller::set_vertical_swing(bool swing_vertical, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.VerticalLouvers)
         return false;
 
     this->changed_configuration.SwingVertical = swing_vertical;
-    this->configuration_changes[SettableFields::SwingVertical] = true;
+    this->change(SettableFields::SwingVertical);
     return true;
 }
 
 bool Controller::set_horizontal_swing(bool swing_horizontal, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.HorizontalLouvers)
         return false;
 
     this->changed_configuration.SwingHorizontal = swing_horizontal;
-    this->configuration_changes[SettableFields::SwingHorizontal] = true;
+    this->change(SettableFields::SwingHorizontal);
     return true;
 }
 
 bool Controller::advance_vertical_louver(bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.VerticalLouvers)
         return false;
 
     this->changed_configuration.Controller.AdvanceVerticalLouver = true;
-    this->configuration_changes[SettableFields::AdvanceVerticalLouver] = true;
+    this->change(SettableFields::AdvanceVerticalLouver);
     return true;
 }
 
 bool Controller::advance_horizontal_louver(bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.HorizontalLouvers)
         return false;
 
     this->changed_configuration.Controller.AdvanceHorizontalLouver = true;
-    this->configuration_changes[SettableFields::AdvanceHorizontalLouver] = true;
+    this->change(SettableFields::AdvanceHorizontalLouver);
     return true;
 }
 
 bool Controller::use_sensor(bool use_sensor, bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.SensorSwitching)
@@ -416,30 +899,31 @@ bool Controller::use_sensor(bool use_sensor, bool ignore_lock) {
 
     this->changed_configuration.Controller.UseControllerSensor = use_sensor;
     // Do not set configuration_changed flag - does not require write bit set
+    this->config_frame_dirty = true;
     return true;
 }
 
 bool Controller::reset_filter(bool ignore_lock) {
-    if (!ignore_lock && (this->current_configuration.IndoorUnit.Lock.All || this->current_configuration.IndoorUnit.Lock.ResetFilterTimer))
+    if (!this->is_writable(ignore_lock, this->current_configuration.IndoorUnit.Lock.ResetFilterTimer))
         return false;
 
     if (!this->features.FilterTimer)
         return false;
 
     this->changed_configuration.Controller.ResetFilterTimer = true;
-    this->configuration_changes[SettableFields::ResetFilterTimer] = true;
+    this->change(SettableFields::ResetFilterTimer);
     return true;
 }
 
 bool Controller::maintenance(bool ignore_lock) {
-    if (!ignore_lock && this->current_configuration.IndoorUnit.Lock.All)
+    if (!this->is_writable(ignore_lock))
         return false;
 
     if (!this->features.Maintenance)
         return false;
 
     this->changed_configuration.Controller.Maintenance = true;
-    this->configuration_changes[SettableFields::Maintenance] = true;
+    this->change(SettableFields::Maintenance);
     return true;
 }
 
@@ -1,15 +1,23 @@
 #pragma once
 
+#include <array>
 #include <bitset>
 #include <functional>
-#include <queue>
 
+#if defined(ESP_PLATFORM)
 #include <driver/uart.h>
+#endif
 
+#include "Clock.h"
+#include "FixedVector.h"
+#include "InplaceFunction.h"
 #include "Packet.h"
+#include "Topology.h"
+#include "UnknownBits.h"
 
 namespace fujitsu_general::airstage::h {
 
+#if defined(ESP_PLATFORM)
 constexpr uart_config_t UARTConfig = {
     .baud_rate = 500,
     .data_bits = UART_DATA_8_BITS,
@@ -19,14 +27,30 @@ constexpr uart_config_t UARTConfig = {
     .rx_flow_ctrl_thresh = 0,
     .source_clk = UART_SCLK_DEFAULT,
 };
+#endif
 
 constexpr uint8_t UARTInterPacketSymbolSpacing = 2;
+constexpr uint64_t UARTByteTime = 22000;  // us; 11 bits (8E1) at 500 baud
 
-// Temperatures are in Celcius
+// Timing, in microseconds
+constexpr uint64_t MaxTxDelay = 150000;               // Latest we start transmitting after reading a frame passing us the token
+constexpr uint64_t InitializationTimeout = 30000000;  // Restart initialization if stuck in a stage after DetectFeatureSupport
+constexpr uint64_t FunctionTimeout = 3000000;         // Wait for the reply to a function request before retrying
+constexpr uint64_t FunctionYield = 2000000;           // Longest the next function request gives way to pending writes
+constexpr uint64_t SilenceTimeout = 5000000;          // No frames for several token rotations; the bus or transport is down
+constexpr uint64_t FrameGapTimeout = 3 * UARTByteTime; // A partial frame followed by a gap this long is discarded
+constexpr uint64_t EchoTimeout = (Packet::FrameSize + 4) * UARTByteTime; // Our frame plus the RX timeout; nobody else transmits before it ends
+
+constexpr uint8_t FunctionAttempts = 3;
+constexpr size_t MaxFunctionRequests = 16;  // Queued or awaiting a reply; further requests fail immediately
+constexpr uint8_t DiscoveryRotations = 5;  // Rotations to listen for before claiming an address automatically
+
+// Setpoints are in whole degrees Celcius
 constexpr uint8_t MinSetpoint = 16;
 constexpr uint8_t MaxSetpoint = 30;
-constexpr float MinTemperature = 0.0;
-constexpr float MaxTemperature = 60.0;
+// Controller sensor temperatures are in half degree steps: 0 to 60 C
+constexpr HalfDegrees MinTemperature = { 0 };
+constexpr HalfDegrees MaxTemperature = { 120 };
 
 constexpr Features DefaultFeatures = {
     .Mode = {
@@ -53,6 +77,48 @@ constexpr Features DefaultFeatures = {
     .VerticalLouvers = false,
 };
 
+// Bit positions of the Features fields in FUJITSU_HALCYON_FEATURES(_MASK), which climate.py
+// defines when autoconf is off so the feature set is known at build time
+namespace FeatureBits {
+    enum {
+        ModeAuto, ModeHeat, ModeFan, ModeDry, ModeCool,
+        FanSpeedQuiet, FanSpeedLow, FanSpeedMedium, FanSpeedHigh, FanSpeedAuto,
+        FilterTimer, SensorSwitching, Maintenance, EconomyMode, HorizontalLouvers, VerticalLouvers,
+        MAX
+    };
+};
+
+// Fields whose bit is set in mask take their value from bits
+constexpr Features apply_feature_bits(Features features, uint32_t mask, uint32_t bits) {
+    auto apply = [mask, bits](bool& field, unsigned bit) {
+        if (mask & (1u << bit))
+            field = bits & (1u << bit);
+    };
+
+    apply(features.Mode.Auto, FeatureBits::ModeAuto);
+    apply(features.Mode.Heat, FeatureBits::ModeHeat);
+    apply(features.Mode.Fan, FeatureBits::ModeFan);
+    apply(features.Mode.Dry, FeatureBits::ModeDry);
+    apply(features.Mode.Cool, FeatureBits::ModeCool);
+    apply(features.FanSpeed.Quiet, FeatureBits::FanSpeedQuiet);
+    apply(features.FanSpeed.Low, FeatureBits::FanSpeedLow);
+    apply(features.FanSpeed.Medium, FeatureBits::FanSpeedMedium);
+    apply(features.FanSpeed.High, FeatureBits::FanSpeedHigh);
+    apply(features.FanSpeed.Auto, FeatureBits::FanSpeedAuto);
+    apply(features.FilterTimer, FeatureBits::FilterTimer);
+    apply(features.SensorSwitching, FeatureBits::SensorSwitching);
+    apply(features.Maintenance, FeatureBits::Maintenance);
+    apply(features.EconomyMode, FeatureBits::EconomyMode);
+    apply(features.HorizontalLouvers, FeatureBits::HorizontalLouvers);
+    apply(features.VerticalLouvers, FeatureBits::VerticalLouvers);
+    return features;
+}
+
+// Features fixed at build time are constants, so checks against them fold away along with feature negotiation
+#if defined(FUJITSU_HALCYON_FEATURES)
+constexpr Features BuildFeatures = apply_feature_bits(DefaultFeatures, FUJITSU_HALCYON_FEATURES_MASK, FUJITSU_HALCYON_FEATURES);
+#endif
+
 enum class InitializationStageEnum : uint8_t {
     DetectFeatureSupport,
     FeatureRequestTx,
@@ -62,6 +128,24 @@ enum class InitializationStageEnum : uint8_t {
     Complete
 };
 
+// Frame counters, indexed by PacketTypeEnum. Cheap enough to always collect.
+struct Statistics {
+    uint32_t RxFrames;
+    uint32_t TxFrames;
+    uint32_t DiscardedBytes;
+    uint32_t FramingErrors;  // Times the receive buffer was resynchronised
+    uint32_t MissedWindows;
+    uint32_t InitializationTimeouts;
+    uint32_t AddressConflicts;  // Frames from another controller using our address
+    uint32_t BusSilences;         // Times no frame was received for SilenceTimeout
+    uint32_t SilenceDetectTime;   // Latest silence: ms from the last frame to detection
+    uint32_t SilenceRecoverTime;  // Latest silence: ms from the first frame after it to initialization complete
+    uint32_t Collisions;  // Echo verification: transmitted frames whose echo differed or did not arrive
+    uint32_t LateEchoes;  // Echo verification: intact echoes read after EchoTimeout, e.g. after a main loop stall
+    std::array<uint32_t, 5> IndoorUnitFrames;
+    std::array<uint32_t, 5> ControllerFrames;
+};
+
 namespace SettableFields {
     enum {
         Enabled,
@@ -81,38 +165,53 @@ namespace SettableFields {
 };
 
 class Controller {
-    using ConfigCallback = std::function<void(const Config&)>;
-    using ErrorCallback  = std::function<void(const Packet&)>;
-    using FunctionCallback = std::function<void(const Function&)>;
-    using ControllerConfigCallback = std::function<void(const uint8_t address, const Config&)>;
-    using InitializationStageCallback = std::function<void(const InitializationStageEnum stage)>;
-    using AvailableBytesCallback = std::function<size_t()>;
-    using ReadBytesCallback  = std::function<void(uint8_t *data, size_t len)>;
-    using WriteBytesCallback = std::function<void(const uint8_t *data, size_t len)>;
-
-    struct Callbacks {
-        ConfigCallback Config;
-        ErrorCallback Error;
-        FunctionCallback Function;
-        ControllerConfigCallback ControllerConfig;
-        InitializationStageCallback InitializationStage;
-        AvailableBytesCallback AvailableBytes;
-        ReadBytesCallback ReadBytes;
-        WriteBytesCallback WriteBytes;
-    };
-
     public:
-        Controller(uint8_t controller_address, const Callbacks& callbacks)
-            : controller_address(controller_address), callbacks(callbacks) {
+        using ConfigCallback = std::function<void(const Config&)>;
+        using ErrorCallback  = std::function<void(const Packet&)>;
+        using FunctionCallback = std::function<void(const Function&)>;
+        using ControllerConfigCallback = std::function<void(const uint8_t address, const Config&)>;
+        using FrameCallback = std::function<void(const Packet::Buffer&)>;
+        using InitializationStageCallback = std::function<void(const InitializationStageEnum stage)>;
+        using AvailableBytesCallback = std::function<size_t()>;
+        using ReadBytesCallback  = std::function<void(uint8_t *data, size_t len)>;
+        using WriteBytesCallback = std::function<void(const uint8_t *data, size_t len)>;
+        using ResetTransportCallback = std::function<void()>;
+
+        // Copied once on construction, so only the copy may allocate
+        struct Callbacks {
+            ConfigCallback Config;
+            ErrorCallback Error;
+            FunctionCallback Function;
+            ControllerConfigCallback ControllerConfig;
+            FrameCallback Frame;  // Every frame received, in wire polarity, before it is processed
+            InitializationStageCallback InitializationStage;
+            AvailableBytesCallback AvailableBytes;
+            ReadBytesCallback ReadBytes;
+            WriteBytesCallback WriteBytes;
+            ResetTransportCallback ResetTransport;  // Called when the bus is silent; should reset the UART and discard buffered data
+        };
+
+        // Completion of a function request; success is false after FunctionAttempts requests without a matching reply.
+        // Stored with the request, so captures must fit in eight pointers.
+        using FunctionResultCallback = InplaceFunction<void(bool success, const Function&), 8 * sizeof(void*)>;
+
+        Controller(uint8_t controller_address, Clock& clock, const Callbacks& callbacks)
+            : controller_address(controller_address), clock(clock), callbacks(callbacks) {
+            this->clock.set_wakeup_callback([this]() { this->on_wakeup(); });
+            this->watchdog_time = this->clock.now();
             this->set_initialization_stage(InitializationStageEnum::DetectFeatureSupport);
         }
 
         void process_uart_data();
         bool is_initialized() const { return this->initialization_stage == InitializationStageEnum::Complete; }
-        void reinitialize() { this->set_initialization_stage(InitializationStageEnum::DetectFeatureSupport); }
+        void reinitialize();
         InitializationStageEnum get_initialization_stage() const { return this->initialization_stage; }
+        bool is_silent() const { return this->silent; }
+        // Bytes of an incomplete or misaligned frame are buffered; process_uart_data() must be called again after FrameGapTimeout
+        bool has_partial_frame() const { return this->rx_length != 0; }
         const struct Features& get_features() const { return this->features; }
 
+#if !defined(FUJITSU_HALCYON_FEATURES)
         // Override the in-code DefaultFeatures with a user-supplied Features struct.
         // Used both as the initial fallback while probing and as the value applied
         // when feature negotiation is skipped or unsupported.
@@ -125,13 +224,41 @@ class Controller {
         // Config and applies the configured features directly. Useful for IUs known
         // to misbehave on FeatureRequest (e.g. enter a non-recoverable error state).
         void set_autoconf(bool autoconf) { this->autoconf = autoconf; }
+#endif
+
+        // Passive monitoring. When true, every frame is still decoded and the callbacks
+        // fire as usual, but the controller never transmits, never claims an address,
+        // and all setters are rejected. Initialization completes on the first IU Config.
+        void set_listen_only(bool listen_only) { this->listen_only = listen_only; }
+        bool is_listen_only() const { return this->listen_only; }
+
+        // Echo verification. The transport must deliver our own transmissions back (LIN transceiver
+        // loopback without RS485 half-duplex mode). Each frame we send is compared with its echo;
+        // a frame that differs, or does not come back, is counted as a collision and sent again
+        // in our next slot.
+        void set_echo_verification(bool echo_verification) { this->echo_verification = echo_verification; }
+
+        // Automatic address. When true, the controller listens for DiscoveryRotations rotations
+        // without transmitting and claims the lowest address no other controller answers for,
+        // keeping the chain contiguous. Discovery is repeated on reinitialize() and when another
+        // controller transmits with our address.
+        void set_auto_address(bool auto_address);
+        bool is_discovering() const { return this->discovering; }
+        uint8_t get_controller_address() const { return this->controller_address; }
+
+        const struct Statistics& get_statistics() const { return this->statistics; }
+        const Topology& get_topology() const { return this->topology; }
 
-        void set_current_temperature(float temperature);
+        // Optional, as the counters take a few KB. Every received frame is counted while set.
+        void set_unknown_bits(UnknownBits* unknown_bits) { this->unknown_bits = unknown_bits; }
+
+        void set_current_temperature(HalfDegrees temperature);
         bool set_enabled(bool enabled, bool ignore_lock = false);
         bool set_economy(bool economy, bool ignore_lock = false);
         bool set_test_run(bool test_run, bool ignore_lock = false);
         bool set_setpoint(uint8_t temperature, bool ignore_lock = false);
         bool set_mode(ModeEnum mode, bool ignore_lock = false);
+        bool can_set_mode(ModeEnum mode, bool ignore_lock = false) const;  // Whether set_mode() would accept mode
         bool set_fan_speed(FanSpeedEnum fan_speed, bool ignore_lock = false);
         bool set_vertical_swing(bool swing_vertical, bool ignore_lock = false);
         bool set_horizontal_swing(bool swing_horizontal, bool ignore_lock = false);
@@ -141,29 +268,130 @@ class Controller {
         bool reset_filter(bool ignore_lock = false);
         bool maintenance(bool ignore_lock = false);
 
-        void get_function(uint8_t function, uint8_t unit) { this->function_queue.push({ .Function = function, .Unit = unit }); }
-        void set_function(uint8_t function, uint8_t value, uint8_t unit) { this->function_queue.push({ true, function, value, unit }); }
+        // Requests are sent one per token, and several may be awaiting replies at once.
+        // Replies carry no destination, so they are matched to requests by function and unit;
+        // requests for a function and unit already awaiting a reply are held until it completes.
+        void get_function(uint8_t function, uint8_t unit, FunctionResultCallback callback = {}) { this->queue_function({ false, function, 0, unit }, std::move(callback)); }
+        void set_function(uint8_t function, uint8_t value, uint8_t unit, FunctionResultCallback callback = {}) { this->queue_function({ true, function, value, unit }, std::move(callback)); }
 
     protected:
         InitializationStageEnum initialization_stage;
         AddressTypeEnum next_token_destination_type = AddressTypeEnum::IndoorUnit;
 
+#if defined(FUJITSU_HALCYON_CONTROLLER_ADDRESS)
+        // Address fixed at build time; the constructor's must match
+        static constexpr bool is_primary_controller() { return FUJITSU_HALCYON_CONTROLLER_ADDRESS == PrimaryAddress; }
+#else
         bool is_primary_controller() const { return this->controller_address == PrimaryAddress; }
+#endif
         void set_initialization_stage(const InitializationStageEnum stage);
         void process_packet(const Packet::Buffer& buffer, bool lastPacketOnWire = true);
 
     private:
+        struct FunctionRequest {
+            struct Function Function;
+            FunctionResultCallback Callback;
+            uint8_t Attempts;
+            bool Sent;          // Awaiting a reply
+            uint64_t Queued;
+            uint64_t Deadline;  // Retry if no reply by this time
+        };
+
+        // What to send when given the token, in priority order for equal deadlines
+        enum class SlotEnum : uint8_t {
+            Error,        // Acknowledgement, due in the slot after the frame that needs it
+            Features,     // Probe during initialization
+            ConfigWrite,  // Config with the Write flag, including the follow-up clearing one-shot flags
+            Function,
+            Config,       // Nothing pending, report our state
+        };
+
         uint8_t controller_address;
+        Clock& clock;
         Callbacks callbacks;
 
+        uint64_t frame_time = 0;  // When the frame being processed was read
+
+        // Framer. Bytes are delivered in bursts ending at an inter-frame gap (the UART RX timeout),
+        // so the end of the buffered bytes is taken as a frame boundary.
+        std::array<uint8_t, 4 * Packet::FrameSize> rx_buffer;
+        size_t rx_length = 0;
+        uint64_t rx_time = 0;  // Last read
+        uint64_t stage_time = 0;  // When the current initialization stage was entered
+
+        // Silence watchdog. Rejoining after a silence skips feature negotiation if it completed before.
+        uint64_t watchdog_time = 0;  // Last frame, or last transport reset while silent
+        uint64_t resume_time = 0;    // First frame after a silence
+        bool silent = false;
+        bool resuming = false;
+        bool features_known = false;
+
+        // Echo verification; what to restore if the frame awaiting its echo collided
+        bool echo_verification = false;
+        bool echo_pending = false;
+        uint64_t echo_deadline = 0;
+        Packet::Buffer echo_frame;
+        SlotEnum echo_slot = SlotEnum::Config;
+        struct Function echo_function = {};
+        std::bitset<SettableFields::MAX> echo_changes;
+        bool echo_reset_filter_timer = false;
+        bool echo_maintenance = false;
+        bool resend_error = false;
+
+#if defined(FUJITSU_HALCYON_FEATURES)
+        static constexpr bool autoconf = false;
+#else
         bool autoconf = true;
+#endif
+        bool listen_only = false;
+        bool auto_address = false;
+        bool discovering = false;
+        uint8_t discovery_rotations = 0;
+        std::bitset<MaxAddress + 1> discovered_addresses;
+        struct Statistics statistics = {};
+        Topology topology;
+        UnknownBits* unknown_bits = nullptr;
+#if defined(FUJITSU_HALCYON_FEATURES)
+        static constexpr struct Features features = BuildFeatures;
+#else
         struct Features features = DefaultFeatures;
+#endif
         struct Config current_configuration = {};
         struct Config changed_configuration = {};
         std::bitset<SettableFields::MAX> configuration_changes;
-        std::queue<struct Function> function_queue;
+        uint64_t change_time = 0;    // When configuration_changes became non-empty
+
+        // Config reply in wire polarity, rebuilt after what it is built from changes rather than
+        // when the token arrives; only the token destination is patched in before sending.
+        Packet::Buffer config_frame;
+        bool config_frame_dirty = true;
+        Packet::Buffer indoor_unit_config_frame {};  // Last received, to tell when the state changed
+        FixedVector<FunctionRequest, MaxFunctionRequests> function_requests;
+        uint64_t function_slot_time = 0;  // Last function request sent
         bool last_error_flag = false; // TODO handle errors for multiple indoor units...multiple errors per IU?
 
+        bool is_writable(bool ignore_lock, bool lock = false) const;
+        void change(size_t field);
+        void build_config_frame();
+        SlotEnum schedule_slot(bool acknowledge_error, const FunctionRequest* request) const;
+        void start_discovery();
+        void discover(const Packet& packet);
+        void claim_address(uint8_t address);
+        void on_silence(uint64_t now);
+        void on_wakeup();
+        void update_wakeup();
+
+        void queue_function(const struct Function& function, FunctionResultCallback callback);
+        FunctionRequest* next_function_request();
+        FunctionResultCallback complete_function_request(const struct Function& reply);
+
+        bool verify_echo(const Packet::Buffer& buffer);
+        void on_collision();
+
+        void process_rx_buffer(uint64_t now, bool burst_ended);
+        size_t find_frame(bool burst_ended) const;
+        void discard_rx_bytes(size_t count);
+
         size_t uart_available_bytes();
         void uart_read_bytes(uint8_t *buf, size_t length);
         void uart_write_bytes(const uint8_t *buf, size_t length);
@@ -0,0 +1,56 @@
+#include "ErrorHistory.h"
+
+namespace fujitsu_general::airstage::h {
+
+bool ErrorHistory::set_error(uint8_t address, uint8_t code, uint8_t extended, uint32_t time) {
+    if (this->state.Size) {
+        auto& record = this->newest();
+
+        if (record.Address == address && record.Code == code && record.Extended == extended) {
+            if (record.Active)
+                return false;
+
+            record.Active = true;
+            if (record.Count < UINT16_MAX)
+                record.Count++;
+            return true;
+        }
+
+        // A different error replaces the active one
+        if (record.Active) {
+            record.Active = false;
+            record.End = time;
+        }
+    }
+
+    this->state.Records[this->state.Next] = {
+        .Start = time,
+        .End = 0,
+        .Count = 1,
+        .Address = address,
+        .Code = code,
+        .Extended = extended,
+        .Active = true,
+    };
+    this->state.Next = (this->state.Next + 1) % Capacity;
+    if (this->state.Size < Capacity)
+        this->state.Size++;
+
+    return true;
+}
+
+bool ErrorHistory::clear_error(uint32_t time) {
+    if (!this->has_active_error())
+        return false;
+
+    auto& record = this->newest();
+    record.Active = false;
+    record.End = time;
+    return true;
+}
+
+bool ErrorHistory::has_active_error() const {
+    return this->state.Size && (*this)[0].Active;
+}
+
+}
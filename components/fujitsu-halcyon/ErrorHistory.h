@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace fujitsu_general::airstage::h {
+
+// Fixed size history of indoor unit errors, oldest overwritten first.
+// A repeat of the most recent error (same address and codes) increments its count instead of
+// taking a new record. The state is trivially copyable so it can be persisted as is.
+class ErrorHistory {
+    public:
+        static constexpr size_t Capacity = 16;
+
+        struct Record {
+            uint32_t Start;     // First occurrence, Unix time or 0 if unknown
+            uint32_t End;       // Last cleared, Unix time or 0 if unknown; only valid if !Active
+            uint16_t Count;
+            uint8_t Address;
+            uint8_t Code;
+            uint8_t Extended;
+            bool Active;
+        };
+
+        struct State {
+            std::array<Record, Capacity> Records;
+            uint8_t Next;       // Index of the next record to write
+            uint8_t Size;
+        };
+
+        // Each returns true if the history changed
+        bool set_error(uint8_t address, uint8_t code, uint8_t extended, uint32_t time);
+        bool clear_error(uint32_t time);
+
+        bool has_active_error() const;
+        size_t size() const { return this->state.Size; }
+
+        // Records from newest (0) to oldest
+        const Record& operator[](size_t index) const {
+            return this->state.Records[(this->state.Next + Capacity - 1 - index) % Capacity];
+        }
+
+        // For persisting; check is_consistent() after restoring
+        State& get_state() { return this->state; }
+        bool is_consistent() const { return this->state.Next < Capacity && this->state.Size <= Capacity; }
+        void clear() { this->state = {}; }
+
+    private:
+        State state {};
+
+        Record& newest() { return this->state.Records[(this->state.Next + Capacity - 1) % Capacity]; }
+};
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace fujitsu_general::airstage::h {
+
+// Vector with its storage embedded, for queues that must not allocate. Elements are
+// default constructed up front; erase() keeps the order of those remaining.
+template <typename T, size_t Capacity>
+class FixedVector {
+    public:
+        using iterator = T*;
+        using const_iterator = const T*;
+
+        iterator begin() { return this->items.data(); }
+        iterator end() { return this->items.data() + this->length; }
+        const_iterator begin() const { return this->items.data(); }
+        const_iterator end() const { return this->items.data() + this->length; }
+
+        size_t size() const { return this->length; }
+        bool empty() const { return this->length == 0; }
+        bool full() const { return this->length == Capacity; }
+        static constexpr size_t capacity() { return Capacity; }
+
+        // False when full
+        bool push_back(T&& item) {
+            if (this->full())
+                return false;
+            this->items[this->length++] = std::move(item);
+            return true;
+        }
+
+        iterator erase(iterator it) {
+            std::move(it + 1, this->end(), it);
+            this->items[--this->length] = T{};
+            return it;
+        }
+
+        void clear() {
+            std::fill(this->begin(), this->end(), T{});
+            this->length = 0;
+        }
+
+    private:
+        std::array<T, Capacity> items {};
+        size_t length = 0;
+};
+
+}
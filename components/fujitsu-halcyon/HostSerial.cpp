@@ -0,0 +1,155 @@
+#include "HostSerial.h"
+
+#if !defined(ESP_PLATFORM)
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#else
+#include <termios.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+
+namespace fujitsu_general::airstage::h {
+
+bool HostSerial::open(const char* path) {
+    this->close();
+
+    this->fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (this->fd < 0)
+        return false;
+
+#if defined(__linux__)
+    struct termios2 tio {};
+    bool ok = ioctl(this->fd, TCGETS2, &tio) == 0;
+#else
+    struct termios tio {};
+    bool ok = tcgetattr(this->fd, &tio) == 0;
+#endif
+
+    if (ok) {
+        tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+        tio.c_oflag &= ~OPOST;
+        tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+        tio.c_cflag &= ~(CSIZE | PARODD | CSTOPB | CRTSCTS);
+        tio.c_cflag |= CS8 | PARENB | CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+
+#if defined(__linux__)
+        tio.c_cflag = (tio.c_cflag & ~CBAUD) | BOTHER;
+        tio.c_ispeed = tio.c_ospeed = 500;
+        ok = ioctl(this->fd, TCSETS2, &tio) == 0;
+#else
+        ok = cfsetspeed(&tio, 500) == 0 && tcsetattr(this->fd, TCSANOW, &tio) == 0;
+#endif
+    }
+
+    if (!ok) {
+        auto error = errno;
+        this->close();
+        errno = error;
+        return false;
+    }
+
+    this->echo_pending = 0;
+    if (!this->read_line_errors(this->line_errors_base))
+        this->line_errors_base = {};
+    return true;
+}
+
+void HostSerial::close() {
+    if (this->fd >= 0) {
+        ::close(this->fd);
+        this->fd = -1;
+    }
+}
+
+size_t HostSerial::available() {
+    int available = 0;
+    if (this->fd < 0 || ioctl(this->fd, FIONREAD, &available) != 0)
+        return 0;
+
+    while (this->echo_pending && available > 0) {
+        uint8_t discard[16];
+        auto n = ::read(this->fd, discard, std::min({ sizeof(discard), this->echo_pending, static_cast<size_t>(available) }));
+        if (n <= 0)
+            break;
+        this->echo_pending -= n;
+        available -= n;
+    }
+
+    return this->echo_pending ? 0 : available;
+}
+
+void HostSerial::read_array(uint8_t* data, size_t length) {
+    for (size_t received = 0; received < length;) {
+        auto n = ::read(this->fd, data + received, length - received);
+        if (n > 0)
+            received += n;
+        else if (n < 0 && errno == EAGAIN) {
+            pollfd pfd = { .fd = this->fd, .events = POLLIN, .revents = 0 };
+            if (poll(&pfd, 1, 100) <= 0)
+                break;
+        }
+        else
+            break;
+    }
+}
+
+const LineErrors& HostSerial::get_line_errors() {
+    // The driver counters run from whenever the port was set up, so only changes are added
+    LineErrors current {};
+    if (this->read_line_errors(current)) {
+        this->line_errors.Parity += current.Parity - this->line_errors_base.Parity;
+        this->line_errors.Framing += current.Framing - this->line_errors_base.Framing;
+        this->line_errors.Overruns += current.Overruns - this->line_errors_base.Overruns;
+        this->line_errors_base = current;
+    }
+
+    return this->line_errors;
+}
+
+bool HostSerial::read_line_errors(LineErrors& errors) const {
+#if defined(__linux__)
+    serial_icounter_struct icount {};
+    if (this->fd >= 0 && ioctl(this->fd, TIOCGICOUNT, &icount) == 0) {
+        errors = {
+            .Parity = static_cast<uint32_t>(icount.parity),
+            .Framing = static_cast<uint32_t>(icount.frame + icount.brk),
+            .Overruns = static_cast<uint32_t>(icount.overrun + icount.buf_overrun),
+        };
+        return true;
+    }
+#endif
+    return false;
+}
+
+void HostSerial::write_array(const uint8_t* data, size_t length) {
+    for (size_t sent = 0; sent < length;) {
+        auto n = ::write(this->fd, data + sent, length - sent);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && errno == EAGAIN) {
+            pollfd pfd = { .fd = this->fd, .events = POLLOUT, .revents = 0 };
+            if (poll(&pfd, 1, 100) <= 0)
+                break;
+        }
+        else
+            break;
+    }
+
+    if (this->local_echo)
+        this->echo_pending += length;
+}
+
+}
+
+#endif
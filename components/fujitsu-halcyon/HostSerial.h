@@ -0,0 +1,52 @@
+#pragma once
+
+#if !defined(ESP_PLATFORM)
+
+#include <cstddef>
+#include <cstdint>
+
+#include "BusHealth.h"
+
+namespace fujitsu_general::airstage::h {
+
+// Serial transport for hosts (ESPHome host platform and the host tools).
+// Opens a tty (USB-LIN adapter) or pseudo-terminal non-blocking at 500 baud 8E1.
+// Linux uses termios2 for the non-standard baud rate; other POSIX hosts pass 500 to cfsetspeed().
+class HostSerial {
+    public:
+        HostSerial() = default;
+        ~HostSerial() { this->close(); }
+        HostSerial(const HostSerial&) = delete;
+        HostSerial& operator=(const HostSerial&) = delete;
+
+        // Returns false with errno set on failure
+        bool open(const char* path);
+        void close();
+        bool is_open() const { return this->fd >= 0; }
+        int get_fd() const { return this->fd; }
+
+        // LIN transceivers loop transmitted bytes back to RX. On the ESP32 this is hidden by the
+        // UART's RS485 half-duplex mode; here the echo is dropped as it arrives instead.
+        void set_local_echo(bool local_echo) { this->local_echo = local_echo; }
+
+        size_t available();
+        void read_array(uint8_t* data, size_t length);
+        void write_array(const uint8_t* data, size_t length);
+
+        // Cumulative across reopens. Only Linux serial drivers that keep interrupt counters
+        // report anything; pseudo-terminals and other hosts stay at zero.
+        const LineErrors& get_line_errors();
+
+    private:
+        int fd = -1;
+        bool local_echo = false;
+        size_t echo_pending = 0;
+
+        LineErrors line_errors {};
+        LineErrors line_errors_base {};  // Driver counters when last read
+        bool read_line_errors(LineErrors& errors) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include "IndoorUnit.h"
+
+#include <algorithm>
+
+namespace fujitsu_general::airstage::h {
+
+void IndoorUnit::loop() {
+    auto now = this->millis();
+
+    this->read_frames(now);
+
+    if (this->have_token) {
+        if (static_cast<int32_t>(now - this->transmit_time) >= 0)
+            this->transmit(now);
+    }
+    // Controller holding the token did not transmit (or does not exist), take it back
+    else if (now - this->token_time >= TokenTimeout) {
+        this->statistics.TokenTimeouts++;
+        this->have_token = true;
+        this->transmit_time = now;
+    }
+}
+
+// Same framing as Controller: frames are buffered across reads, resynchronised to the next plausible
+// frame if the buffer does not start with one, and a partial frame is dropped after a gap.
+void IndoorUnit::read_frames(uint32_t now) {
+    if (!this->callbacks.AvailableBytes || !this->callbacks.ReadBytes)
+        return;
+
+    if (auto available = this->callbacks.AvailableBytes()) {
+        auto length = std::min(available, this->rx_buffer.size() - this->rx_length);
+        this->callbacks.ReadBytes(this->rx_buffer.data() + this->rx_length, length);
+        this->rx_length += length;
+        this->rx_time = now;
+    }
+    else if (this->rx_length && now - this->rx_time > FrameGapTimeout / 1000)
+        this->discard_rx_bytes(this->rx_length);
+
+    while (this->rx_length >= Packet::FrameSize) {
+        if (!Packet::is_plausible(this->rx_buffer.data())) {
+            size_t offset = 1;
+            while (offset + Packet::FrameSize <= this->rx_length && !Packet::is_plausible(&this->rx_buffer[offset]))
+                offset++;
+            this->discard_rx_bytes(offset);
+            continue;
+        }
+
+        Packet::Buffer buffer;
+        std::copy_n(this->rx_buffer.begin(), buffer.size(), buffer.begin());
+        std::copy(this->rx_buffer.begin() + buffer.size(), this->rx_buffer.begin() + this->rx_length, this->rx_buffer.begin());
+        this->rx_length -= buffer.size();
+        this->process_packet(buffer, now);
+    }
+}
+
+void IndoorUnit::discard_rx_bytes(size_t count) {
+    this->statistics.DiscardedBytes += count;
+    std::copy(this->rx_buffer.begin() + count, this->rx_buffer.begin() + this->rx_length, this->rx_buffer.begin());
+    this->rx_length -= count;
+}
+
+void IndoorUnit::set_error(uint8_t code, uint8_t extended) {
+    this->error.ErrorCode = code;
+    this->error.ErrorCodeExtended = extended;
+    this->config.IndoorUnit.Error = code != 0;
+}
+
+void IndoorUnit::process_packet(const Packet::Buffer& buffer, uint32_t now) {
+    Packet packet(buffer);
+
+    // Ignore our own loopback and other indoor units
+    if (packet.SourceType != AddressTypeEnum::Controller)
+        return;
+
+    this->statistics.ControllerFrames[packet.SourceAddress]++;
+    this->token_time = now;
+
+    switch (packet.Type) {
+        case PacketTypeEnum::Config:
+            if (packet.SourceAddress == PrimaryAddress)
+                this->config.IndoorUnit.SeenController.Primary = true;
+            else
+                this->config.IndoorUnit.SeenController.Secondary = true;
+
+            if (packet.Config.Controller.Write) {
+                this->statistics.Writes++;
+
+                this->config.Enabled = packet.Config.Enabled;
+                this->config.Economy = packet.Config.Economy;
+                this->config.TestRun = packet.Config.TestRun;
+                this->config.Setpoint = packet.Config.Setpoint;
+                this->config.Mode = packet.Config.Mode;
+                this->config.FanSpeed = packet.Config.FanSpeed;
+                this->config.SwingVertical = packet.Config.SwingVertical;
+                this->config.SwingHorizontal = packet.Config.SwingHorizontal;
+
+                if (packet.Config.Controller.ResetFilterTimer)
+                    this->config.IndoorUnit.FilterTimerExpired = false;
+            }
+            break;
+
+        case PacketTypeEnum::Error:
+            this->reply_type = PacketTypeEnum::Error;
+            break;
+
+        case PacketTypeEnum::Features:
+            this->reply_type = PacketTypeEnum::Features;
+            break;
+
+        case PacketTypeEnum::Function:
+            if (packet.Function.Controller.Write)
+                this->functions[packet.Function.Function] = packet.Function.Value;
+
+            this->reply_function = {
+                .Controller = {},
+                .Function = packet.Function.Function,
+                .Value = this->functions[packet.Function.Function],
+                .Unit = packet.Function.Unit,
+            };
+            this->reply_type = PacketTypeEnum::Function;
+            break;
+
+        case PacketTypeEnum::Status:
+            break;
+    }
+
+    if (this->callbacks.ControllerFrame)
+        this->callbacks.ControllerFrame(packet);
+
+    if (packet.TokenDestinationType == AddressTypeEnum::IndoorUnit) {
+        this->have_token = true;
+        this->transmit_time = now + this->response_delay + (this->jitter ? this->next_random() % (this->jitter + 1) : 0);
+    }
+}
+
+void IndoorUnit::transmit(uint32_t now) {
+    Packet packet;
+    packet.SourceType = AddressTypeEnum::IndoorUnit;
+    packet.SourceAddress = Address;
+    packet.TokenDestinationType = AddressTypeEnum::Controller;
+    packet.TokenDestinationAddress = PrimaryAddress;
+    packet.Type = this->reply_type;
+
+    switch (packet.Type) {
+        case PacketTypeEnum::Config:
+            packet.Config = this->config;
+            break;
+
+        case PacketTypeEnum::Error:
+            packet.Error = this->error;
+            break;
+
+        case PacketTypeEnum::Features:
+            packet.Features = this->features;
+            break;
+
+        case PacketTypeEnum::Function:
+            packet.Function = this->reply_function;
+            break;
+
+        case PacketTypeEnum::Status:
+            break;
+    }
+
+    this->reply_type = PacketTypeEnum::Config;
+
+    auto buffer = packet.to_buffer();
+    if (this->callbacks.WriteBytes)
+        this->callbacks.WriteBytes(buffer.data(), buffer.size());
+
+    this->have_token = false;
+    this->token_time = now;
+    this->statistics.Rotations++;
+}
+
+uint32_t IndoorUnit::next_random() {
+    // xorshift32, deterministic for a given seed so runs can be reproduced
+    this->random_state ^= this->random_state << 13;
+    this->random_state ^= this->random_state >> 17;
+    this->random_state ^= this->random_state << 5;
+    return this->random_state;
+}
+
+}
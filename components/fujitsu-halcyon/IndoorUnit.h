@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+#include "Clock.h"
+#include "Controller.h"
+#include "Packet.h"
+
+namespace fujitsu_general::airstage::h {
+
+// Indoor unit emulator for hardware-in-the-loop testing of controllers.
+// Owns the token rotation: transmits a frame with the token for the primary controller,
+// follows the token through the controllers and resumes when it is returned, or when
+// the controller holding it does not transmit within TokenTimeout.
+class IndoorUnit {
+    using FrameCallback = std::function<void(const Packet&)>;
+    using AvailableBytesCallback = std::function<size_t()>;
+    using ReadBytesCallback  = std::function<void(uint8_t *data, size_t len)>;
+    using WriteBytesCallback = std::function<void(const uint8_t *data, size_t len)>;
+
+    struct Callbacks {
+        FrameCallback ControllerFrame;
+        AvailableBytesCallback AvailableBytes;
+        ReadBytesCallback ReadBytes;
+        WriteBytesCallback WriteBytes;
+    };
+
+    public:
+        static constexpr uint8_t Address = 1;
+        // Our frame and the reply on the wire, the controller's reply delay, and as much again for read latency
+        static constexpr uint32_t TokenTimeout = 2 * (2 * Packet::FrameSize * UARTByteTime + MaxTxDelay) / 1000; // ms
+
+        struct Statistics {
+            uint32_t Rotations;
+            uint32_t TokenTimeouts;
+            uint32_t Writes;
+            uint32_t DiscardedBytes;
+            std::array<uint32_t, MaxAddress + 1> ControllerFrames;
+        };
+
+        IndoorUnit(Clock& clock, const Callbacks& callbacks) : clock(clock), callbacks(callbacks) {}
+
+        void loop();
+
+        void set_features(const Features& features) { this->features = features; }
+        void set_config(const Config& config) { this->config = config; }
+        const Config& get_config() const { return this->config; }
+
+        // Sets the error flag in subsequent Config frames and reports the code to Error requests.
+        // A code of 0 clears the error.
+        void set_error(uint8_t code, uint8_t extended = 0);
+
+        // Delay between receiving the token and transmitting, plus up to jitter ms of random delay
+        void set_response_delay(uint32_t delay) { this->response_delay = delay; }
+        void set_jitter(uint32_t jitter, uint32_t seed = 1) { this->jitter = jitter; this->random_state = seed ? seed : 1; }
+
+        void set_function(uint8_t function, uint8_t value) { this->functions[function] = value; }
+
+        const Statistics& get_statistics() const { return this->statistics; }
+
+    private:
+        Clock& clock;
+        Callbacks callbacks;
+
+        Features features {};
+        Config config {};
+        struct Error error {};
+        std::array<uint8_t, 256> functions {};
+
+        uint32_t response_delay = 20;
+        uint32_t jitter = 0;
+        uint32_t random_state = 1;
+
+        // Reads can end mid-frame; the rest of the frame completes it on a later loop
+        std::array<uint8_t, 4 * Packet::FrameSize> rx_buffer;
+        size_t rx_length = 0;
+        uint32_t rx_time = 0;
+
+        bool have_token = true;
+        uint32_t token_time = 0;
+        uint32_t transmit_time = 0;
+
+        PacketTypeEnum reply_type = PacketTypeEnum::Config;
+        struct Function reply_function {};
+
+        Statistics statistics {};
+
+        void read_frames(uint32_t now);
+        void discard_rx_bytes(size_t count);
+        void process_packet(const Packet::Buffer& buffer, uint32_t now);
+        void transmit(uint32_t now);
+        uint32_t next_random();
+
+        uint32_t millis() const { return this->clock.now() / 1000; }
+};
+
+}
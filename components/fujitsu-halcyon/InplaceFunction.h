@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace fujitsu_general::airstage::h {
+
+// std::function that never allocates. The callable is stored in the object; one larger than
+// Capacity is a compile error instead of a heap allocation.
+template <typename Signature, size_t Capacity = 2 * sizeof(void*)>
+class InplaceFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+    public:
+        InplaceFunction() = default;
+        InplaceFunction(std::nullptr_t) {}
+
+        template <typename F, typename T = std::decay_t<F>,
+            typename = std::enable_if_t<!std::is_same_v<T, InplaceFunction> && std::is_invocable_r_v<R, T&, Args...>>>
+        InplaceFunction(F&& f) {
+            static_assert(sizeof(T) <= Capacity, "Callable does not fit in InplaceFunction, capture less or raise Capacity");
+            static_assert(alignof(T) <= alignof(std::max_align_t));
+
+            new (this->storage) T(std::forward<F>(f));
+            this->invoke = [](void* f, Args... args) -> R { return (*static_cast<T*>(f))(std::forward<Args>(args)...); };
+            this->manage = [](void* dst, void* src, Operation operation) {
+                switch (operation) {
+                    case Operation::Copy: new (dst) T(*static_cast<const T*>(src)); break;
+                    case Operation::Move: new (dst) T(std::move(*static_cast<T*>(src))); static_cast<T*>(src)->~T(); break;
+                    case Operation::Destroy: static_cast<T*>(dst)->~T(); break;
+                }
+            };
+        }
+
+        InplaceFunction(const InplaceFunction& other) { this->copy_from(other); }
+        InplaceFunction(InplaceFunction&& other) noexcept { this->move_from(other); }
+        ~InplaceFunction() { this->reset(); }
+
+        InplaceFunction& operator=(const InplaceFunction& other) {
+            if (this != &other) {
+                this->reset();
+                this->copy_from(other);
+            }
+            return *this;
+        }
+
+        InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+            if (this != &other) {
+                this->reset();
+                this->move_from(other);
+            }
+            return *this;
+        }
+
+        InplaceFunction& operator=(std::nullptr_t) { this->reset(); return *this; }
+
+        explicit operator bool() const { return this->invoke != nullptr; }
+        R operator()(Args... args) const { return this->invoke(this->storage, std::forward<Args>(args)...); }
+
+    private:
+        enum class Operation : uint8_t { Copy, Move, Destroy };
+
+        void copy_from(const InplaceFunction& other) {
+            if (other.manage)
+                other.manage(this->storage, other.storage, Operation::Copy);
+            this->invoke = other.invoke;
+            this->manage = other.manage;
+        }
+
+        // Leaves other empty, as std::function does
+        void move_from(InplaceFunction& other) {
+            if (other.manage)
+                other.manage(this->storage, other.storage, Operation::Move);
+            this->invoke = other.invoke;
+            this->manage = other.manage;
+            other.invoke = nullptr;
+            other.manage = nullptr;
+        }
+
+        void reset() {
+            if (this->manage)
+                this->manage(this->storage, nullptr, Operation::Destroy);
+            this->invoke = nullptr;
+            this->manage = nullptr;
+        }
+
+        alignas(std::max_align_t) mutable std::byte storage[Capacity];
+        R (*invoke)(void*, Args...) = nullptr;
+        void (*manage)(void*, void*, Operation) = nullptr;
+};
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#if __has_include(<esphome/core/log.h>)
+//#include <esp_log.h>
+// Log through esphome instead of standard esp logging
+#include <esphome/core/log.h>
+using esphome::esp_log_printf_;
+#else
+// Host builds without esphome (tools)
+#include <cstdio>
+#define ESP_LOGE(tag, format, ...) std::fprintf(stderr, "[E][%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) std::fprintf(stderr, "[W][%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) std::fprintf(stderr, "[I][%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+#define ESP_LOGV(tag, format, ...) do {} while (0)
+#endif
@@ -1,5 +1,3 @@
-#include <cmath>
-
 #include "Packet.h"
 
 namespace fujitsu_general::airstage::h {
@@ -43,8 +41,7 @@ Packet::Packet(Buffer buffer) {
                 this->Config.Controller.AdvanceVerticalLouver = getField(BMS.Config.Controller.AdvanceVerticalLouver);
                 this->Config.Controller.AdvanceHorizontalLouver = getField(BMS.Config.Controller.AdvanceHorizontalLouver);
 
-                auto temperature = getField(BMS.Config.Controller.Temperature);
-                this->Config.Controller.Temperature = (temperature >> 1) + (temperature & 1) / 2.0;
+                this->Config.Controller.Temperature = { getField(BMS.Config.Controller.Temperature) };
                 this->Config.Controller.UseControllerSensor = getField(BMS.Config.Controller.UseControllerSensor);
 
                 this->Config.Controller.Maintenance = getField(BMS.Config.Controller.Maintenance);
@@ -151,10 +148,7 @@ Packet::Buffer Packet::to_buffer() const {
                 setField(BMS.Config.Controller.AdvanceVerticalLouver, this->Config.Controller.AdvanceVerticalLouver);
                 setField(BMS.Config.Controller.AdvanceHorizontalLouver, this->Config.Controller.AdvanceHorizontalLouver);
 
-                setField(BMS.Config.Controller.Temperature,
-                    (int(this->Config.Controller.Temperature) << 1) +
-                    int(std::fmod(std::round(this->Config.Controller.Temperature * 2), 2))
-                );
+                setField(BMS.Config.Controller.Temperature, this->Config.Controller.Temperature.Steps);
 
                 setField(BMS.Config.Controller.UseControllerSensor, this->Config.Controller.UseControllerSensor);
                 setField(BMS.Config.Controller.Maintenance, this->Config.Controller.Maintenance);
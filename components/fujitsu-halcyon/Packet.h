@@ -38,6 +38,15 @@ enum class ModeEnum : uint8_t {
     Auto
 };
 
+// Temperature in the wire's half degree Celsius steps, so the codec and controller need no floating point
+struct HalfDegrees {
+    uint8_t Steps;
+
+    constexpr float celsius() const { return this->Steps * 0.5f; }
+    constexpr explicit operator bool() const { return this->Steps != 0; }
+    constexpr bool operator==(const HalfDegrees&) const = default;
+};
+
 struct Config {
     struct {
         struct {
@@ -61,7 +70,7 @@ struct Config {
     } IndoorUnit;
 
     struct {
-        float Temperature;
+        HalfDegrees Temperature;
         bool Write;
         bool UseControllerSensor;
         bool AdvanceHorizontalLouver;
@@ -247,6 +256,21 @@ class Packet {
         struct Features Features {};
         struct Status Status {};
 
+        // Cheap sanity check used to find frame boundaries; buffer is in wire polarity
+        static bool is_plausible(const uint8_t* buffer) {
+            const uint8_t type = (static_cast<uint8_t>(~buffer[BMS.Type.byte]) & BMS.Type.mask) >> BMS.Type.shift;
+            return (~buffer[1] & 0b10000000) && type <= static_cast<uint8_t>(PacketTypeEnum::Status); // Byte 1 bit 7 is set in all captured packets
+        }
+
+        // Patches the token destination into a buffer in wire polarity
+        static void set_token_destination(Buffer& buffer, AddressTypeEnum type, uint8_t address) {
+            static_assert(BMS.TokenDestinationType.byte == 1 && BMS.TokenDestinationAddress.byte == 1);
+            constexpr uint8_t mask = BMS.TokenDestinationType.mask | BMS.TokenDestinationAddress.mask;
+            const uint8_t value = ((static_cast<uint8_t>(type) << BMS.TokenDestinationType.shift) & BMS.TokenDestinationType.mask) |
+                ((address << BMS.TokenDestinationAddress.shift) & BMS.TokenDestinationAddress.mask);
+            buffer[1] = (buffer[1] | mask) & ~value;
+        }
+
         static void invert_buffer(Buffer& buffer) { *reinterpret_cast<uint64_t*>(buffer.data()) = ~*reinterpret_cast<uint64_t*>(buffer.data()); };
 };
 
@@ -0,0 +1,39 @@
+#include "Runtime.h"
+
+namespace fujitsu_general::airstage::h {
+
+void RuntimeCounters::update(const Config& config, uint64_t time) {
+    if (this->have_last && time - this->last_time <= MaxGap) {
+        const auto elapsed = time - this->last_time + this->carry;
+        const auto seconds = static_cast<uint32_t>(elapsed / 1000000);
+        this->carry = elapsed % 1000000;
+
+        if (seconds) {
+            const auto& last = this->last_config;
+
+            if (last.Enabled) {
+                this->state.Enabled += seconds;
+
+                if (auto mode = static_cast<size_t>(last.Mode) - 1; mode < this->state.Mode.size())
+                    this->state.Mode[mode] += seconds;
+
+                if (auto fan_speed = static_cast<size_t>(last.FanSpeed); fan_speed < this->state.FanSpeed.size())
+                    this->state.FanSpeed[fan_speed] += seconds;
+            }
+
+            if (last.IndoorUnit.StandbyMode)
+                this->state.Standby += seconds;
+
+            if (last.IndoorUnit.Error)
+                this->state.Error += seconds;
+        }
+    }
+    else
+        this->carry = 0;
+
+    this->last_config = config;
+    this->last_time = time;
+    this->have_last = true;
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "Packet.h"
+
+namespace fujitsu_general::airstage::h {
+
+// Run time accumulated from the indoor unit's Config frames, in seconds.
+// Each frame credits the time since the previous frame to the state the previous frame
+// reported. Sub-second remainders carry over to the next frame, so nothing is lost to rounding.
+class RuntimeCounters {
+    public:
+        static constexpr uint64_t MaxGap = 10000000; // us; longer gaps between frames (no bus) are not counted
+
+        struct State {
+            uint32_t Enabled;
+            std::array<uint32_t, 5> Mode;     // Enabled, by ModeEnum - 1 (Fan, Dry, Cool, Heat, Auto)
+            std::array<uint32_t, 5> FanSpeed; // Enabled, by FanSpeedEnum (Auto, Quiet, Low, Medium, High)
+            uint32_t Standby;                 // Defrosting, oil recovery...
+            uint32_t Error;
+        };
+
+        // time is monotonic, in microseconds
+        void update(const Config& config, uint64_t time);
+
+        // For persisting and resetting
+        State& get_state() { return this->state; }
+        void clear() { this->state = {}; }
+
+    private:
+        State state {};
+
+        Config last_config {};
+        uint64_t last_time = 0;
+        uint64_t carry = 0;
+        bool have_last = false;
+};
+
+}
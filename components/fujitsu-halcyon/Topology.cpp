@@ -0,0 +1,29 @@
+#include "Topology.h"
+
+namespace fujitsu_general::airstage::h {
+
+void Topology::update(const Packet& packet, uint64_t time) {
+    auto& entry = this->entries[packet.SourceAddress & MaxAddress];
+
+    entry.LastSeen = time;
+    entry.Frames++;
+    entry.Seen = true;
+
+    if (packet.Type == PacketTypeEnum::Config) {
+        entry.Temperature = packet.Config.Controller.Temperature;
+        entry.UseControllerSensor = packet.Config.Controller.UseControllerSensor;
+        entry.Write = packet.Config.Controller.Write;
+        if (entry.Write)
+            entry.Writes++;
+    }
+}
+
+int Topology::temperature_source(uint64_t time) const {
+    for (uint8_t address = 0; address < this->entries.size(); address++)
+        if (this->is_alive(address, time) && this->entries[address].Temperature)
+            return address;
+
+    return -1;
+}
+
+}
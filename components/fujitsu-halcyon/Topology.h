@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Packet.h"
+
+namespace fujitsu_general::airstage::h {
+
+// Controllers seen on the bus, by address, built from the frames they transmit.
+// Entries are never removed; an entry not heard from within Expiry is reported as lost,
+// which is how a dead wall controller shows up.
+class Topology {
+    public:
+        static constexpr uint64_t Expiry = 10000000; // us; many token rotations
+
+        struct Entry {
+            uint64_t LastSeen;         // us
+            uint32_t Frames;
+            uint32_t Writes;           // Config frames with the Write flag set
+            HalfDegrees Temperature;   // From the last Config frame, 0 if not reported
+            bool UseControllerSensor;  // From the last Config frame
+            bool Write;                // From the last Config frame
+            bool Seen;
+        };
+
+        // packet must be from a controller; time is monotonic, in microseconds
+        void update(const Packet& packet, uint64_t time);
+
+        const Entry& operator[](uint8_t address) const { return this->entries[address & MaxAddress]; }
+        bool is_alive(uint8_t address, uint64_t time) const {
+            auto& entry = (*this)[address];
+            return entry.Seen && time - entry.LastSeen <= Expiry;
+        }
+
+        // Lowest live address reporting a temperature, or -1 if none
+        int temperature_source(uint64_t time) const;
+
+        void clear() { this->entries = {}; }
+
+    private:
+        std::array<Entry, MaxAddress + 1> entries {};
+};
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+// Hot path tracepoints. Without FUJITSU_HALCYON_TRACING defined the macros expand to nothing.
+//
+//   FUJITSU_HALCYON_TRACE(Decode);        // Times the rest of the enclosing block
+//   FUJITSU_HALCYON_TRACE_BEGIN(Decode);  // Times up to the matching end in the same block
+//   FUJITSU_HALCYON_TRACE_END(Decode);
+//
+// Durations are in CPU cycles on the ESP32, TSC ticks on x86 hosts and nanoseconds elsewhere,
+// collected per stage into log2 histograms: bucket n counts durations in [2^n, 2^(n+1)).
+
+#if defined(FUJITSU_HALCYON_TRACING)
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(ESP_PLATFORM)
+#include <esp_cpu.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace fujitsu_general::airstage::h::trace {
+
+enum class StageEnum : uint8_t {
+    Read,      // UART read into the framer
+    Decode,    // Packet from wire buffer
+    Merge,     // Config reply from current state and pending changes
+    Encode,    // Packet to wire buffer
+    Write,     // UART write
+    Callback,  // Deferred callback after transmitting
+    Publish,   // Component entity updates from an indoor unit Config
+    MAX
+};
+
+constexpr std::array StageName = { "Read", "Decode", "Merge", "Encode", "Write", "Callback", "Publish" };
+static_assert(StageName.size() == static_cast<size_t>(StageEnum::MAX));
+
+#if defined(ESP_PLATFORM)
+constexpr const char* Unit = "cycles";
+inline uint32_t now() { return esp_cpu_get_cycle_count(); }
+#elif defined(__x86_64__) || defined(__i386__)
+constexpr const char* Unit = "TSC ticks";
+inline uint32_t now() { return static_cast<uint32_t>(__rdtsc()); }
+#else
+constexpr const char* Unit = "ns";
+inline uint32_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
+
+struct Histogram {
+    std::array<uint32_t, 32> Buckets;
+    uint32_t Count;
+    uint32_t Max;
+    uint64_t Total;
+
+    void add(uint32_t duration) {
+        this->Buckets[duration ? std::bit_width(duration) - 1 : 0]++;
+        this->Count++;
+        this->Total += duration;
+        if (duration > this->Max)
+            this->Max = duration;
+    }
+};
+
+inline std::array<Histogram, static_cast<size_t>(StageEnum::MAX)> histograms {};
+
+inline void add(StageEnum stage, uint32_t duration) { histograms[static_cast<size_t>(stage)].add(duration); }
+inline void clear() { histograms = {}; }
+
+// One line per stage: "<stage>: <count> mean <mean> max <max> | <bucket>:<count>..."
+inline void format(StageEnum stage, char* buf, size_t length) {
+    auto& histogram = histograms[static_cast<size_t>(stage)];
+    int written = std::snprintf(buf, length, "%s: %u mean %llu max %u |", StageName[static_cast<size_t>(stage)],
+        static_cast<unsigned>(histogram.Count), histogram.Count ? static_cast<unsigned long long>(histogram.Total / histogram.Count) : 0ull,
+        static_cast<unsigned>(histogram.Max));
+
+    for (size_t bucket = 0; bucket < histogram.Buckets.size() && written > 0 && static_cast<size_t>(written) < length; bucket++)
+        if (histogram.Buckets[bucket])
+            written += std::snprintf(buf + written, length - written, " 2^%zu:%u", bucket, static_cast<unsigned>(histogram.Buckets[bucket]));
+}
+
+class Scope {
+    public:
+        explicit Scope(StageEnum stage) : stage(stage), start(now()) {}
+        ~Scope() { add(this->stage, now() - this->start); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StageEnum stage;
+        uint32_t start;
+};
+
+}
+
+#define FUJITSU_HALCYON_TRACE_NAME(line) fujitsu_halcyon_trace_##line
+#define FUJITSU_HALCYON_TRACE_SCOPE(stage, line) \
+    ::fujitsu_general::airstage::h::trace::Scope FUJITSU_HALCYON_TRACE_NAME(line)(::fujitsu_general::airstage::h::trace::StageEnum::stage)
+#define FUJITSU_HALCYON_TRACE(stage) FUJITSU_HALCYON_TRACE_SCOPE(stage, __LINE__)
+#define FUJITSU_HALCYON_TRACE_BEGIN(stage) const uint32_t fujitsu_halcyon_trace_##stage = ::fujitsu_general::airstage::h::trace::now()
+#define FUJITSU_HALCYON_TRACE_END(stage) \
+    ::fujitsu_general::airstage::h::trace::add(::fujitsu_general::airstage::h::trace::StageEnum::stage, \
+        ::fujitsu_general::airstage::h::trace::now() - fujitsu_halcyon_trace_##stage)
+
+#else
+
+#define FUJITSU_HALCYON_TRACE(stage)
+#define FUJITSU_HALCYON_TRACE_BEGIN(stage)
+#define FUJITSU_HALCYON_TRACE_END(stage)
+
+#endif
@@ -0,0 +1,24 @@
+#include <bit>
+
+#include "UnknownBits.h"
+
+namespace fujitsu_general::airstage::h {
+
+void UnknownBits::update(const Packet::Buffer& buffer) {
+    // Same layout as the masks: byte 0 in the low bits
+    uint64_t value = 0;
+    for (size_t i = 0; i < buffer.size(); i++)
+        value |= uint64_t(static_cast<uint8_t>(~buffer[i])) << (i * 8);
+
+    const auto source = static_cast<AddressTypeEnum>((value >> (BMS.SourceType.byte * 8) & BMS.SourceType.mask) >> BMS.SourceType.shift);
+    const auto type = static_cast<PacketTypeEnum>((value >> (BMS.Type.byte * 8) & BMS.Type.mask) >> BMS.Type.shift);
+    const auto i = index(source, type);
+
+    this->frames[i]++;
+
+    // Usually only the few always-set bits remain, so this is a handful of iterations
+    for (auto unknown = value & ~known_mask(source, type); unknown; unknown &= unknown - 1)
+        this->counts[i][std::countr_zero(unknown)]++;
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "Packet.h"
+
+namespace fujitsu_general::airstage::h {
+
+// Counts how often each bit Packet does not decode is set, by source and packet type.
+// Bits are numbered byte * 8 + bit (bit 7 is the most significant) in logical polarity.
+// Bits set in every frame (e.g. byte 1 bit 7) show up with a count equal to the frame count;
+// anything else is a candidate for a protocol variant or an undocumented field.
+// UnknownFlags is decoded but not understood, so it is counted as unknown.
+class UnknownBits {
+    public:
+        static constexpr size_t PacketTypes = 8; // Type is 3 bits; 5-7 are not defined
+
+        // Bits decoded by Packet for frames from source of type
+        static constexpr uint64_t known_mask(AddressTypeEnum source, PacketTypeEnum type) {
+            auto mask = bits(BMS.SourceType, BMS.SourceAddress, BMS.TokenDestinationType, BMS.TokenDestinationAddress, BMS.Type);
+            const bool indoor_unit = source == AddressTypeEnum::IndoorUnit;
+
+            switch (type) {
+                case PacketTypeEnum::Config:
+                    mask |= bits(BMS.Config.FanSpeed, BMS.Config.Mode, BMS.Config.Enabled, BMS.Config.Economy, BMS.Config.TestRun,
+                        BMS.Config.Setpoint, BMS.Config.SwingHorizontal, BMS.Config.SwingVertical);
+                    if (indoor_unit)
+                        mask |= bits(BMS.Config.IndoorUnit.Lock.ResetFilterTimer, BMS.Config.IndoorUnit.Lock.Enabled, BMS.Config.IndoorUnit.Lock.Mode,
+                            BMS.Config.IndoorUnit.Lock.Timer, BMS.Config.IndoorUnit.Lock.All, BMS.Config.IndoorUnit.SeenController.Secondary,
+                            BMS.Config.IndoorUnit.SeenController.Primary, BMS.Config.IndoorUnit.StandbyMode, BMS.Config.IndoorUnit.Error,
+                            BMS.Config.IndoorUnit.FilterTimerExpired);
+                    else
+                        mask |= bits(BMS.Config.Controller.Write, BMS.Config.Controller.UseControllerSensor, BMS.Config.Controller.AdvanceHorizontalLouver,
+                            BMS.Config.Controller.AdvanceVerticalLouver, BMS.Config.Controller.Temperature, BMS.Config.Controller.ResetFilterTimer,
+                            BMS.Config.Controller.Maintenance);
+                    break;
+
+                case PacketTypeEnum::Error:
+                    if (indoor_unit)
+                        mask |= bits(BMS.Error.ErrorCodeExtended, BMS.Error.ErrorCode);
+                    break;
+
+                case PacketTypeEnum::Features:
+                    if (indoor_unit)
+                        mask |= bits(BMS.Features.Mode.Auto, BMS.Features.Mode.Heat, BMS.Features.Mode.Fan, BMS.Features.Mode.Dry, BMS.Features.Mode.Cool,
+                            BMS.Features.FanSpeed.Quiet, BMS.Features.FanSpeed.Low, BMS.Features.FanSpeed.Medium, BMS.Features.FanSpeed.High,
+                            BMS.Features.FanSpeed.Auto, BMS.Features.FilterTimer, BMS.Features.SensorSwitching, BMS.Features.Maintenance,
+                            BMS.Features.EconomyMode, BMS.Features.HorizontalLouvers, BMS.Features.VerticalLouvers);
+                    break;
+
+                case PacketTypeEnum::Function:
+                    mask |= bits(BMS.Function.Function, BMS.Function.Value, BMS.Function.Unit);
+                    if (!indoor_unit)
+                        mask |= bits(BMS.Function.Controller.Write);
+                    break;
+
+                default:
+                    break;
+            }
+
+            return mask;
+        }
+
+        // buffer is in wire polarity, as read from the UART
+        void update(const Packet::Buffer& buffer);
+
+        uint32_t get_frames(AddressTypeEnum source, PacketTypeEnum type) const { return this->frames[index(source, type)]; }
+        uint32_t get_count(AddressTypeEnum source, PacketTypeEnum type, uint8_t bit) const { return this->counts[index(source, type)][bit & 63]; }
+
+        void clear() { this->frames = {}; this->counts = {}; }
+
+    private:
+        std::array<uint32_t, 2 * PacketTypes> frames {};
+        std::array<std::array<uint32_t, 64>, 2 * PacketTypes> counts {};
+
+        static constexpr size_t index(AddressTypeEnum source, PacketTypeEnum type) {
+            return (static_cast<size_t>(source) & 1) * PacketTypes + (static_cast<size_t>(type) & (PacketTypes - 1));
+        }
+
+        template<typename... T>
+        static constexpr uint64_t bits(const T&... bms) {
+            return ((uint64_t(bms.mask) << (bms.byte * 8)) | ...);
+        }
+};
+
+}
@@ -10,6 +10,7 @@ from esphome.components import (
     sensor,
     switch,
     text_sensor,
+    time,
     uart
 )
 
@@ -27,6 +28,8 @@ from esphome.const import (
     CONF_INTERNAL,
     CONF_MODE,
     CONF_NAME,
+    CONF_PORT,
+    CONF_TIME_ID,
     CONF_UART_ID,
     DEVICE_CLASS_TEMPERATURE,
     DEVICE_CLASS_CONNECTIVITY,
@@ -35,12 +38,13 @@ from esphome.const import (
     ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
     UNIT_CELSIUS,
+    UNIT_PERCENT,
 )
 
+from esphome.core import CORE
 from esphome.types import ConfigType
 
 CODEOWNERS = ["@Omniflux"]
-DEPENDENCIES = ["uart"]
 
 def AUTO_LOAD(config: ConfigType) -> list[str]:
     load = ["binary_sensor", "button", "climate", "number", "sensor", "switch", "text_sensor"]
@@ -51,10 +55,15 @@ def AUTO_LOAD(config: ConfigType) -> list[str]:
     return load
 
 CONF_CONTROLLER_ADDRESS = "controller_address"
+CONF_AUTO = "auto"
 CONF_TEMPERATURE_CONTROLLER_ADDRESS = "temperature_controller_address"
 CONF_TEMPERATURE_SENSOR = "temperature_sensor_id"
 CONF_USE_SENSOR = "use_sensor"
 CONF_IGNORE_LOCK = "ignore_lock"
+CONF_LISTEN_ONLY = "listen_only"
+CONF_VERIFY_ECHO = "verify_echo"
+CONF_DIAGNOSTICS_INTERVAL = "diagnostics_interval"
+CONF_LOCAL_ECHO = "local_echo"
 
 # Feature negotiation override options.
 # When the indoor unit responds to a FeatureRequest with a Features packet, the
@@ -86,8 +95,17 @@ CONF_ADVANCE_HORIZONTAL_LOUVER = "advance_horizontal_louver"
 CONF_RESET_FILTER_TIMER = "reset_filter_timer"
 CONF_FILTER_TIMER_EXPIRED = "filter_timer_expired"
 CONF_REINITIALIZE = "reinitialize"
+CONF_DUMP_UNKNOWN_BITS = "dump_unknown_bits"
+CONF_DUMP_TRACE = "dump_trace"
 CONF_CONNECTED = "connected"
 CONF_SUPPORTED_FEATURES = "supported_features"
+CONF_STATISTICS = "statistics"
+CONF_ERROR_HISTORY = "error_history"
+CONF_RUNTIME = "runtime"
+CONF_RUNTIME_SAVE_INTERVAL = "runtime_save_interval"
+CONF_TOPOLOGY = "topology"
+CONF_BUS_HEALTH = "bus_health"
+CONF_LINE_ERRORS = "line_errors"
 
 CONF_FUNCTION = "function"
 CONF_FUNCTION_VALUE = "function_value"
@@ -111,11 +129,14 @@ UART_INTER_PACKET_SYMBOL_SPACING = 2
 
 COMPONENT_NAME = __name__.split('.')[-2]
 
-CONFIG_SCHEMA = climate.climate_schema(FujitsuHalcyonController).extend(
+BASE_SCHEMA = climate.climate_schema(FujitsuHalcyonController).extend(
     {
-        cv.Optional(CONF_CONTROLLER_ADDRESS, default=0): cv.int_range(0, 15),
-        cv.Optional(CONF_TEMPERATURE_CONTROLLER_ADDRESS, default=0): cv.int_range(0, 15),
+        cv.Optional(CONF_CONTROLLER_ADDRESS, default=0): cv.Any(cv.one_of(CONF_AUTO, lower=True), cv.int_range(0, 15)),
+        cv.Optional(CONF_TEMPERATURE_CONTROLLER_ADDRESS, default=0): cv.Any(cv.one_of(CONF_AUTO, lower=True), cv.int_range(0, 15)),
         cv.Optional(CONF_IGNORE_LOCK, default=False): cv.boolean,
+        cv.Optional(CONF_LISTEN_ONLY, default=False): cv.boolean,
+        cv.Optional(CONF_VERIFY_ECHO, default=False): cv.boolean,
+        cv.Optional(CONF_DIAGNOSTICS_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
         cv.Optional(CONF_TEMPERATURE_SENSOR): cv.use_id(sensor.Sensor),
         cv.Optional(CONF_HUMIDITY_SENSOR): cv.use_id(sensor.Sensor),
         cv.Optional(CONF_AUTOCONF): cv.boolean,
@@ -194,6 +215,14 @@ CONFIG_SCHEMA = climate.climate_schema(FujitsuHalcyonController).extend(
             CustomButton,
             entity_category=ENTITY_CATEGORY_CONFIG,
         ),
+        cv.Optional(CONF_DUMP_UNKNOWN_BITS): button.button_schema(
+            CustomButton,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_DUMP_TRACE): button.button_schema(
+            CustomButton,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
         cv.Optional(CONF_CONNECTED, default={CONF_NAME: "Connected"}): binary_sensor.binary_sensor_schema(
             BinarySensor,
             entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
@@ -203,11 +232,47 @@ CONFIG_SCHEMA = climate.climate_schema(FujitsuHalcyonController).extend(
             TextSensor,
             entity_category=ENTITY_CATEGORY_DIAGNOSTIC
         ),
+        cv.Optional(CONF_STATISTICS): text_sensor.text_sensor_schema(
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_RUNTIME): text_sensor.text_sensor_schema(
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_RUNTIME_SAVE_INTERVAL, default="1h"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_TOPOLOGY): text_sensor.text_sensor_schema(
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_BUS_HEALTH): sensor.sensor_schema(
+            unit_of_measurement=UNIT_PERCENT,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_LINE_ERRORS): text_sensor.text_sensor_schema(
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_ERROR_HISTORY): text_sensor.text_sensor_schema(
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC
+        ),
+        cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
     }
-).extend(cv.COMPONENT_SCHEMA).extend(uart.UART_DEVICE_SCHEMA)
+).extend(cv.COMPONENT_SCHEMA)
 
 if TZSP_AVAILABLE:
-    CONFIG_SCHEMA = CONFIG_SCHEMA.extend(tzsp.TZSP_SENDER_SCHEMA)
+    BASE_SCHEMA = BASE_SCHEMA.extend(tzsp.TZSP_SENDER_SCHEMA)
+
+UART_SCHEMA = BASE_SCHEMA.extend(uart.UART_DEVICE_SCHEMA)
+
+# ESPHome host platform: a tty (USB-LIN adapter) or pseudo-terminal opened at 500 baud 8E1
+HOST_SCHEMA = BASE_SCHEMA.extend(
+    {
+        cv.Required(CONF_PORT): cv.string_strict,
+        cv.Optional(CONF_LOCAL_ECHO, default=False): cv.boolean,
+    }
+)
+
+def CONFIG_SCHEMA(config):
+    return HOST_SCHEMA(config) if CORE.is_host else UART_SCHEMA(config)
 
 def check_esphome_version(config):
     if cv.parse_esphome_version() < (2026, 3, 0):
@@ -247,60 +312,151 @@ def final_validate_uart_schema(config):
 
     return config
 
-FINAL_VALIDATE_SCHEMA = cv.All(
-    check_esphome_version,
-    final_validate_uart_schema,
-    uart.final_validate_device_schema(
+def final_validate_uart_device_schema(config):
+    # A listen only controller never transmits, so it can be wired RX only
+    return uart.final_validate_device_schema(
         COMPONENT_NAME,
-        require_tx=True,
+        require_tx=not config[CONF_LISTEN_ONLY],
         require_rx=True,
         baud_rate=500,
         data_bits=8,
         parity="EVEN",
         stop_bits=1,
-    ),
+    )(config)
+
+def final_validate_transport(config):
+    if CORE.is_host:
+        return config
+
+    return cv.All(
+        final_validate_uart_schema,
+        final_validate_uart_device_schema,
+    )(config)
+
+FINAL_VALIDATE_SCHEMA = cv.All(
+    check_esphome_version,
+    final_validate_transport,
 )
 
+# With autoconf the indoor unit reports its own features, so any of them is possible.
+# Without, only the configured features (or the in-code defaults) are used.
+def possible_feature(config, key, default=False):
+    if config.get(CONF_AUTOCONF, True):
+        return True
+    return config.get(key, default)
+
+def possible_swing_modes(config):
+    if config.get(CONF_AUTOCONF, True):
+        return True, True
+    swing_modes = set(config.get(CONF_SUPPORTED_SWING_MODES, []))
+    return ("VERTICAL" in swing_modes or "BOTH" in swing_modes), ("HORIZONTAL" in swing_modes or "BOTH" in swing_modes)
+
+def single_instance():
+    return sum(1 for conf in CORE.config.get("climate", []) if conf.get("platform") == "fujitsu-halcyon") == 1
+
+# Bit positions follow FeatureBits in Controller.h. Returns (bits, mask), the mask
+# covering only what the YAML sets so the rest keeps the DefaultFeatures value.
+def feature_bits(config):
+    bits = mask = 0
+
+    def apply(bit, value):
+        nonlocal bits, mask
+        mask |= 1 << bit
+        if value:
+            bits |= 1 << bit
+
+    if CONF_SUPPORTED_MODES in config:
+        modes = set(config[CONF_SUPPORTED_MODES])
+        for bit, mode in enumerate(["AUTO", "HEAT", "FAN", "DRY", "COOL"]):
+            apply(bit, mode in modes)
+    if CONF_SUPPORTED_FAN_MODES in config:
+        fan_modes = set(config[CONF_SUPPORTED_FAN_MODES])
+        for bit, fan_mode in enumerate(["QUIET", "LOW", "MEDIUM", "HIGH", "AUTO"], start=5):
+            apply(bit, fan_mode in fan_modes)
+    for bit, key in enumerate([CONF_FILTER_TIMER, CONF_SENSOR_SWITCHING, CONF_MAINTENANCE, CONF_ECONOMY_MODE], start=10):
+        if key in config:
+            apply(bit, config[key])
+    if CONF_SUPPORTED_SWING_MODES in config:
+        vertical, horizontal = possible_swing_modes(config)
+        apply(14, horizontal)
+        apply(15, vertical)
+
+    return bits, mask
+
+# Entities configured visible are always generated; hidden ones only if they can be revealed
+def generate_entity(config, key, usable):
+    return usable or not config[key].get(CONF_INTERNAL, False)
+
 async def to_code(config: ConfigType) -> None:
-    var = await climate.new_climate(config, await cg.get_variable(config[uart.CONF_UART_ID]), config[CONF_CONTROLLER_ADDRESS])
-    await cg.register_component(var, config)
-    await uart.register_uart_device(var, config)
+    auto_address = config[CONF_CONTROLLER_ADDRESS] == CONF_AUTO
+    controller_address = 0 if auto_address else config[CONF_CONTROLLER_ADDRESS]
+    auto_temperature_controller_address = config[CONF_TEMPERATURE_CONTROLLER_ADDRESS] == CONF_AUTO
+
+    if CORE.is_host:
+        var = await climate.new_climate(config, controller_address)
+        await cg.register_component(var, config)
+        cg.add(var.set_port(config[CONF_PORT]))
+        cg.add(var.set_local_echo(config[CONF_LOCAL_ECHO]))
+    else:
+        var = await climate.new_climate(config, await cg.get_variable(config[uart.CONF_UART_ID]), controller_address)
+        await cg.register_component(var, config)
+        await uart.register_uart_device(var, config)
 
     if TZSP_AVAILABLE and config.get(tzsp.CONF_TZSP):
         await tzsp.register_tzsp_sender(var, config)
         cg.add_define("USE_TZSP")
 
-    cg.add(var.set_temperature_controller_address(config[CONF_TEMPERATURE_CONTROLLER_ADDRESS]))
+    if auto_temperature_controller_address:
+        cg.add(var.set_auto_temperature_controller_address(True))
+    else:
+        cg.add(var.set_temperature_controller_address(config[CONF_TEMPERATURE_CONTROLLER_ADDRESS]))
     cg.add(var.set_ignore_lock(config[CONF_IGNORE_LOCK]))
+    cg.add(var.set_listen_only(config[CONF_LISTEN_ONLY]))
+    cg.add(var.set_verify_echo(config[CONF_VERIFY_ECHO]))
+    cg.add(var.set_auto_address(auto_address))
+    cg.add(var.set_diagnostics_interval(config[CONF_DIAGNOSTICS_INTERVAL]))
+
+    # Without autoconf the features never change, so they are compiled in as constants
+    # and feature negotiation is left out of the build. Build flags apply to every
+    # instance, so this is only done for a single controller.
+    single = single_instance()
+    fixed_features = feature_bits(config) if single and config.get(CONF_AUTOCONF) is False else None
+    if fixed_features is not None:
+        bits, mask = fixed_features
+        cg.add_build_flag(f"-DFUJITSU_HALCYON_FEATURES={bits:#06x}")
+        cg.add_build_flag(f"-DFUJITSU_HALCYON_FEATURES_MASK={mask:#06x}")
+    if single and not auto_address:
+        cg.add_build_flag(f"-DFUJITSU_HALCYON_CONTROLLER_ADDRESS={controller_address}")
 
     # Apply feature negotiation overrides. Anything omitted from YAML keeps the
     # in-code DefaultFeatures value.
-    if CONF_AUTOCONF in config:
-        cg.add(var.set_autoconf(config[CONF_AUTOCONF]))
-    if CONF_SUPPORTED_MODES in config:
-        modes = set(config[CONF_SUPPORTED_MODES])
-        cg.add(var.set_supported_modes(
-            "AUTO" in modes, "HEAT" in modes, "FAN" in modes, "DRY" in modes, "COOL" in modes
-        ))
-    if CONF_SUPPORTED_FAN_MODES in config:
-        fan_modes = set(config[CONF_SUPPORTED_FAN_MODES])
-        cg.add(var.set_supported_fan_modes(
-            "QUIET" in fan_modes, "LOW" in fan_modes, "MEDIUM" in fan_modes,
-            "HIGH" in fan_modes, "AUTO" in fan_modes
-        ))
-    if CONF_SUPPORTED_SWING_MODES in config:
-        swing_modes = set(config[CONF_SUPPORTED_SWING_MODES])
-        vertical = "VERTICAL" in swing_modes or "BOTH" in swing_modes
-        horizontal = "HORIZONTAL" in swing_modes or "BOTH" in swing_modes
-        cg.add(var.set_supported_swing_modes(vertical, horizontal))
-    if CONF_FILTER_TIMER in config:
-        cg.add(var.set_filter_timer(config[CONF_FILTER_TIMER]))
-    if CONF_SENSOR_SWITCHING in config:
-        cg.add(var.set_sensor_switching(config[CONF_SENSOR_SWITCHING]))
-    if CONF_MAINTENANCE in config:
-        cg.add(var.set_maintenance(config[CONF_MAINTENANCE]))
-    if CONF_ECONOMY_MODE in config:
-        cg.add(var.set_economy_mode(config[CONF_ECONOMY_MODE]))
+    if fixed_features is None:
+        if CONF_AUTOCONF in config:
+            cg.add(var.set_autoconf(config[CONF_AUTOCONF]))
+        if CONF_SUPPORTED_MODES in config:
+            modes = set(config[CONF_SUPPORTED_MODES])
+            cg.add(var.set_supported_modes(
+                "AUTO" in modes, "HEAT" in modes, "FAN" in modes, "DRY" in modes, "COOL" in modes
+            ))
+        if CONF_SUPPORTED_FAN_MODES in config:
+            fan_modes = set(config[CONF_SUPPORTED_FAN_MODES])
+            cg.add(var.set_supported_fan_modes(
+                "QUIET" in fan_modes, "LOW" in fan_modes, "MEDIUM" in fan_modes,
+                "HIGH" in fan_modes, "AUTO" in fan_modes
+            ))
+        if CONF_SUPPORTED_SWING_MODES in config:
+            swing_modes = set(config[CONF_SUPPORTED_SWING_MODES])
+            vertical = "VERTICAL" in swing_modes or "BOTH" in swing_modes
+            horizontal = "HORIZONTAL" in swing_modes or "BOTH" in swing_modes
+            cg.add(var.set_supported_swing_modes(vertical, horizontal))
+        if CONF_FILTER_TIMER in config:
+            cg.add(var.set_filter_timer(config[CONF_FILTER_TIMER]))
+        if CONF_SENSOR_SWITCHING in config:
+            cg.add(var.set_sensor_switching(config[CONF_SENSOR_SWITCHING]))
+        if CONF_MAINTENANCE in config:
+            cg.add(var.set_maintenance(config[CONF_MAINTENANCE]))
+        if CONF_ECONOMY_MODE in config:
+            cg.add(var.set_economy_mode(config[CONF_ECONOMY_MODE]))
 
     varx = cg.Pvariable(config[CONF_STANDBY_MODE][CONF_ID], var.standby_sensor)
     await binary_sensor.register_binary_sensor(varx, config[CONF_STANDBY_MODE])
@@ -314,65 +470,114 @@ async def to_code(config: ConfigType) -> None:
     varx = cg.Pvariable(config[CONF_INITIALIZATION_STAGE][CONF_ID], var.initialization_sensor)
     await text_sensor.register_text_sensor(varx, config[CONF_INITIALIZATION_STAGE])
 
-    varx = cg.Pvariable(config[CONF_USE_SENSOR][CONF_ID], var.use_sensor_switch)
-    await switch.register_switch(varx, config[CONF_USE_SENSOR])
+    # Entities hidden until feature negotiation reveals them are generated only if the
+    # feature is possible and the controller could act on them
+    writable = not config[CONF_LISTEN_ONLY]
+    vertical_louvers, horizontal_louvers = possible_swing_modes(config)
 
-    varx = cg.Pvariable(config[CONF_GET_FUNCTION][CONF_ID], var.get_function)
-    await button.register_button(varx, config[CONF_GET_FUNCTION])
+    if generate_entity(config, CONF_USE_SENSOR, writable and CONF_TEMPERATURE_SENSOR in config and possible_feature(config, CONF_SENSOR_SWITCHING)):
+        varx = cg.Pvariable(config[CONF_USE_SENSOR][CONF_ID], var.create_use_sensor_switch())
+        await switch.register_switch(varx, config[CONF_USE_SENSOR])
 
-    varx = cg.Pvariable(config[CONF_SET_FUNCTION][CONF_ID], var.set_function)
-    await button.register_button(varx, config[CONF_SET_FUNCTION])
+    if generate_entity(config, CONF_ADVANCE_VERTICAL_LOUVER, writable and vertical_louvers):
+        varx = cg.Pvariable(config[CONF_ADVANCE_VERTICAL_LOUVER][CONF_ID], var.create_advance_vertical_louver_button())
+        await button.register_button(varx, config[CONF_ADVANCE_VERTICAL_LOUVER])
 
-    varx = cg.Pvariable(config[CONF_ADVANCE_VERTICAL_LOUVER][CONF_ID], var.advance_vertical_louver_button)
-    await button.register_button(varx, config[CONF_ADVANCE_VERTICAL_LOUVER])
+    if generate_entity(config, CONF_ADVANCE_HORIZONTAL_LOUVER, writable and horizontal_louvers):
+        varx = cg.Pvariable(config[CONF_ADVANCE_HORIZONTAL_LOUVER][CONF_ID], var.create_advance_horizontal_louver_button())
+        await button.register_button(varx, config[CONF_ADVANCE_HORIZONTAL_LOUVER])
 
-    varx = cg.Pvariable(config[CONF_ADVANCE_HORIZONTAL_LOUVER][CONF_ID], var.advance_horizontal_louver_button)
-    await button.register_button(varx, config[CONF_ADVANCE_HORIZONTAL_LOUVER])
+    if generate_entity(config, CONF_RESET_FILTER_TIMER, writable and possible_feature(config, CONF_FILTER_TIMER)):
+        varx = cg.Pvariable(config[CONF_RESET_FILTER_TIMER][CONF_ID], var.create_reset_filter_button())
+        await button.register_button(varx, config[CONF_RESET_FILTER_TIMER])
 
-    varx = cg.Pvariable(config[CONF_RESET_FILTER_TIMER][CONF_ID], var.reset_filter_button)
-    await button.register_button(varx, config[CONF_RESET_FILTER_TIMER])
-
-    varx = cg.Pvariable(config[CONF_FILTER_TIMER_EXPIRED][CONF_ID], var.filter_sensor)
-    await binary_sensor.register_binary_sensor(varx, config[CONF_FILTER_TIMER_EXPIRED])
+    if generate_entity(config, CONF_FILTER_TIMER_EXPIRED, possible_feature(config, CONF_FILTER_TIMER)):
+        varx = cg.Pvariable(config[CONF_FILTER_TIMER_EXPIRED][CONF_ID], var.create_filter_sensor())
+        await binary_sensor.register_binary_sensor(varx, config[CONF_FILTER_TIMER_EXPIRED])
 
     varx = cg.Pvariable(config[CONF_REINITIALIZE][CONF_ID], var.reinitialize_button)
     await button.register_button(varx, config[CONF_REINITIALIZE])
 
+    if CONF_DUMP_UNKNOWN_BITS in config:
+        varx = cg.Pvariable(config[CONF_DUMP_UNKNOWN_BITS][CONF_ID], var.create_dump_unknown_bits_button())
+        await button.register_button(varx, config[CONF_DUMP_UNKNOWN_BITS])
+        cg.add(var.set_track_unknown_bits(True))
+
+    # Tracepoints are compiled in only when they can be dumped
+    if CONF_DUMP_TRACE in config:
+        varx = cg.Pvariable(config[CONF_DUMP_TRACE][CONF_ID], var.create_dump_trace_button())
+        await button.register_button(varx, config[CONF_DUMP_TRACE])
+        cg.add_build_flag("-DFUJITSU_HALCYON_TRACING")
+
     varx = cg.Pvariable(config[CONF_CONNECTED][CONF_ID], var.connected_sensor)
     await binary_sensor.register_binary_sensor(varx, config[CONF_CONNECTED])
 
-    varx = cg.Pvariable(config[CONF_SUPPORTED_FEATURES][CONF_ID], var.supported_features_sensor)
-    await text_sensor.register_text_sensor(varx, config[CONF_SUPPORTED_FEATURES])
+    # Features fixed at build time never change, so there is nothing to report
+    if fixed_features is None:
+        varx = cg.Pvariable(config[CONF_SUPPORTED_FEATURES][CONF_ID], var.create_supported_features_sensor())
+        await text_sensor.register_text_sensor(varx, config[CONF_SUPPORTED_FEATURES])
 
     varx = cg.Pvariable(config[CONF_REMOTE_SENSOR][CONF_ID], var.remote_sensor)
     await sensor.register_sensor(varx, config[CONF_REMOTE_SENSOR])
 
-    varx = cg.Pvariable(config[CONF_FUNCTION][CONF_ID], var.function)
-    await number.register_number(
-        varx,
-        config[CONF_FUNCTION],
-        min_value=0,
-        max_value=255,
-        step=1
-    )
-
-    varx = cg.Pvariable(config[CONF_FUNCTION_VALUE][CONF_ID], var.function_value)
-    await number.register_number(
-        varx,
-        config[CONF_FUNCTION_VALUE],
-        min_value=0,
-        max_value=255,
-        step=1
-    )
-
-    varx = cg.Pvariable(config[CONF_FUNCTION_UNIT][CONF_ID], var.function_unit)
-    await number.register_number(
-        varx,
-        config[CONF_FUNCTION_UNIT],
-        min_value=0,
-        max_value=15,
-        step=1
-    )
+    # A listen only controller cannot send function requests
+    if writable:
+        cg.add(var.create_function_entities())
+
+        varx = cg.Pvariable(config[CONF_GET_FUNCTION][CONF_ID], var.get_function)
+        await button.register_button(varx, config[CONF_GET_FUNCTION])
+
+        varx = cg.Pvariable(config[CONF_SET_FUNCTION][CONF_ID], var.set_function)
+        await button.register_button(varx, config[CONF_SET_FUNCTION])
+
+        varx = cg.Pvariable(config[CONF_FUNCTION][CONF_ID], var.function)
+        await number.register_number(
+            varx,
+            config[CONF_FUNCTION],
+            min_value=0,
+            max_value=255,
+            step=1
+        )
+
+        varx = cg.Pvariable(config[CONF_FUNCTION_VALUE][CONF_ID], var.function_value)
+        await number.register_number(
+            varx,
+            config[CONF_FUNCTION_VALUE],
+            min_value=0,
+            max_value=255,
+            step=1
+        )
+
+        varx = cg.Pvariable(config[CONF_FUNCTION_UNIT][CONF_ID], var.function_unit)
+        await number.register_number(
+            varx,
+            config[CONF_FUNCTION_UNIT],
+            min_value=0,
+            max_value=15,
+            step=1
+        )
+
+    if CONF_STATISTICS in config:
+        cg.add(var.set_statistics_sensor(await text_sensor.new_text_sensor(config[CONF_STATISTICS])))
+
+    if CONF_RUNTIME in config:
+        cg.add(var.set_runtime_sensor(await text_sensor.new_text_sensor(config[CONF_RUNTIME])))
+        cg.add(var.set_runtime_save_interval(config[CONF_RUNTIME_SAVE_INTERVAL]))
+
+    if CONF_TOPOLOGY in config:
+        cg.add(var.set_topology_sensor(await text_sensor.new_text_sensor(config[CONF_TOPOLOGY])))
+
+    if CONF_BUS_HEALTH in config:
+        cg.add(var.set_bus_health_sensor(await sensor.new_sensor(config[CONF_BUS_HEALTH])))
+
+    if CONF_LINE_ERRORS in config:
+        cg.add(var.set_line_errors_sensor(await text_sensor.new_text_sensor(config[CONF_LINE_ERRORS])))
+
+    if CONF_ERROR_HISTORY in config:
+        cg.add(var.set_error_history_sensor(await text_sensor.new_text_sensor(config[CONF_ERROR_HISTORY])))
+
+    if CONF_TIME_ID in config:
+        cg.add(var.set_time(await cg.get_variable(config[CONF_TIME_ID])))
 
     if CONF_TEMPERATURE_SENSOR in config:
         cg.add(var.set_temperature_sensor(await cg.get_variable(config[CONF_TEMPERATURE_SENSOR])))
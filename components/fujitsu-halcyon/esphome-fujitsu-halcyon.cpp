@@ -1,37 +1,102 @@
 #include "esphome-fujitsu-halcyon.h"
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <type_traits>
 
 #include <esphome/core/helpers.h>
 
+#include "Trace.h"
+
 namespace esphome::fujitsu_general_airstage_h_controller {
 
 static const auto TAG = "esphome::fujitsu_general_airstage_h_controller";
 
 constexpr std::array ControllerName = { "Primary", "Secondary", "Undocumented" };
 
+// Sensor readings enter the controller in the wire's half degree steps, once per reading rather than per frame
+static fujitsu_general::airstage::h::HalfDegrees to_half_degrees(float celsius) {
+    using fujitsu_general::airstage::h::MinTemperature;
+    using fujitsu_general::airstage::h::MaxTemperature;
+
+    if (!std::isfinite(celsius))
+        return MinTemperature;
+    return { static_cast<uint8_t>(std::lround(std::clamp(celsius, MinTemperature.celsius(), MaxTemperature.celsius()) * 2)) };
+}
+
+#if !defined(USE_HOST) && !defined(USE_UART_WAKE_LOOP_ON_RX)
+// The uart component keeps the driver's event queue protected and offers no accessor for it. A member
+// pointer named through a derived class reaches it without changing the uart component. This relies on
+// ESPHome internals (checked against 2026.3), so a change to the member fails the build here rather than
+// at runtime; with wake_loop_on_rx set, this is not compiled and the supported uart hook is used instead.
+struct UARTEventQueue : uart::IDFUARTComponent {
+    static_assert(std::is_same_v<decltype(UARTEventQueue::uart_event_queue_), QueueHandle_t>,
+        "uart::IDFUARTComponent::uart_event_queue_ changed: set wake_loop_on_rx on the uart, or update UARTEventQueue");
+
+    static QueueHandle_t get(uart::IDFUARTComponent* uart) { return uart->*&UARTEventQueue::uart_event_queue_; }
+};
+#endif
+
 void FujitsuHalcyonController::loop() {
+    this->loop_count_++;
     this->controller->process_uart_data();
+
+#if !defined(USE_HOST)
+    // Nothing to do until the UART event task reports received bytes or the clock a due wakeup.
+    // A partial frame keeps the loop running so it can be discarded after the inter-frame gap.
+    if (this->uart_event_task_ != nullptr && this->available() == 0 && !this->controller->has_partial_frame())
+        this->disable_loop();
+#endif
 }
 
 void FujitsuHalcyonController::setup() {
+#if defined(USE_HOST)
+    if (!this->serial_.open(this->port_)) {
+        ESP_LOGE(TAG, "Failed to open %s: %s", this->port_, std::strerror(errno));
+        this->mark_failed();
+        return;
+    }
+
+    // The controller compares the echo with what it sent, so it must not be dropped
+    if (this->verify_echo_)
+        this->serial_.set_local_echo(false);
+#else
     // Currently no way to do this in IDFUARTComponent YAML configuration without setting the flow control pin.
     // Using RTS is not needed, but the side effect of suppressing input during output is, as the LIN chip provides loopback.
-    if (auto err = uart_set_mode(static_cast<uart_port_t>(static_cast<uart::IDFUARTComponent*>(this->parent_)->get_hw_serial_number()), UART_MODE_RS485_HALF_DUPLEX); err != ESP_OK) {
+    // Echo verification needs that loopback, so leaves the UART in normal mode.
+    if (auto err = uart_set_mode(static_cast<uart_port_t>(static_cast<uart::IDFUARTComponent*>(this->parent_)->get_hw_serial_number()), this->uart_mode()); err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set UART mode: %s", esp_err_to_name(err));
         this->mark_failed();
         return;
     }
 
-    this->controller = new fujitsu_general::airstage::h::Controller(
+    // With wake_loop_on_rx the uart component reads the event queue itself, so the loop keeps polling
+#if !defined(USE_UART_WAKE_LOOP_ON_RX)
+    this->uart_events_ = UARTEventQueue::get(static_cast<uart::IDFUARTComponent*>(this->parent_));
+    if (this->uart_events_ != nullptr && xTaskCreate(uart_event_task, "fujitsu_halcyon", 2560, this, 5, &this->uart_event_task_) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to start UART event task, polling instead");
+        this->uart_event_task_ = nullptr;
+    }
+#endif
+
+    // Timeouts and retries are due without any bytes arriving
+    this->clock_.set_notify_callback([this]() { this->enable_loop_soon_any_context(); });
+#endif
+
+    this->controller.emplace(
         this->controller_address_,
-        {
+        this->clock_,
+        fujitsu_general::airstage::h::Controller::Callbacks {
             .Config = [this](const fujitsu_general::airstage::h::Config& data){ this->update_from_device(data); },
             .Error  = [this](const fujitsu_general::airstage::h::Packet& data){ this->update_from_device(data); },
-            .Function = [this](const fujitsu_general::airstage::h::Function& data){ this->update_from_device(data); },
+            .Function = {},  // Replies reach the function entities through their request's completion callback
             .ControllerConfig = [this](const uint8_t address, const fujitsu_general::airstage::h::Config& data){ this->update_from_controller(address, data); },
+            .Frame = [this](const fujitsu_general::airstage::h::Packet::Buffer& buffer){ this->log_buffer("RX", buffer.data(), buffer.size()); },
             .InitializationStage = [this](const fujitsu_general::airstage::h::InitializationStageEnum stage){
                 this->on_initialization_stage(stage);
             },
@@ -40,12 +105,12 @@ void FujitsuHalcyonController::setup() {
             },
             .ReadBytes  = [this](uint8_t *buf, size_t length){
                 this->read_array(buf, length);
-                this->log_buffer("RX", buf, length);
             },
             .WriteBytes = [this](const uint8_t *buf, size_t length){
                 this->write_array(buf, length);
                 this->log_buffer("TX", buf, length);
-            }
+            },
+            .ResetTransport = [this](){ this->reset_transport(); }
         }
     );
 
@@ -54,8 +119,18 @@ void FujitsuHalcyonController::setup() {
     // called from to_code(); fields the user did not specify still hold their
     // DefaultFeatures value. Must be applied before the first packet is processed;
     // setup() runs before loop() so this is safe.
+#if !defined(FUJITSU_HALCYON_FEATURES)
     this->controller->set_features(this->features_override_);
     this->controller->set_autoconf(this->autoconf_);
+#endif
+    this->controller->set_listen_only(this->listen_only_);
+    this->controller->set_echo_verification(this->verify_echo_);
+    this->controller->set_auto_address(this->auto_address_);
+
+    if (this->track_unknown_bits_) {
+        this->unknown_bits_ = std::make_unique<fujitsu_general::airstage::h::UnknownBits>();
+        this->controller->set_unknown_bits(this->unknown_bits_.get());
+    }
 
     this->connected_sensor->publish_initial_state(false);
 
@@ -70,7 +145,7 @@ void FujitsuHalcyonController::setup() {
                 this->publish_state();
 
                 // Send this temperature to the Fujitsu IU
-                this->controller->set_current_temperature(this->current_temperature);
+                this->controller->set_current_temperature(to_half_degrees(this->current_temperature));
             });
 
             this->current_temperature = esphome::fahrenheit_to_celsius(this->temperature_sensor_->state);
@@ -83,7 +158,7 @@ void FujitsuHalcyonController::setup() {
                 this->publish_state();
 
                 // Send this temperature to the Fujitsu IU
-                this->controller->set_current_temperature(state);
+                this->controller->set_current_temperature(to_half_degrees(state));
             });
 
             this->current_temperature = this->temperature_sensor_->state;
@@ -107,6 +182,35 @@ void FujitsuHalcyonController::setup() {
         });
     }
 
+    if (this->statistics_sensor_ != nullptr)
+        this->set_interval("statistics", this->diagnostics_interval_, [this]() { this->publish_statistics(); });
+
+    if (this->topology_sensor_ != nullptr)
+        this->set_interval("topology", this->diagnostics_interval_, [this]() { this->publish_topology(); });
+
+    if (this->bus_health_sensor_ != nullptr || this->line_errors_sensor_ != nullptr)
+        this->set_interval("bus_health", BusHealthInterval, [this]() { this->publish_bus_health(); });
+
+    if (this->runtime_sensor_ != nullptr) {
+        this->runtime_pref_ = global_preferences->make_preference<fujitsu_general::airstage::h::RuntimeCounters::State>(
+            this->get_object_id_hash() ^ 0x52554E54 /* RUNT */, true);
+        if (!this->runtime_pref_.load(&this->runtime_.get_state()))
+            this->runtime_.clear();
+
+        this->set_interval("runtime", this->diagnostics_interval_, [this]() { this->publish_runtime(); });
+        this->set_interval("runtime_save", this->runtime_save_interval_, [this]() { this->runtime_pref_.save(&this->runtime_.get_state()); });
+    }
+
+    // Saved only on error transitions, and written to flash by the preferences flash_write_interval
+    if (this->error_history_sensor_ != nullptr) {
+        this->error_history_pref_ = global_preferences->make_preference<fujitsu_general::airstage::h::ErrorHistory::State>(
+            this->get_object_id_hash() ^ 0x45525248 /* ERRH */, true);
+        if (!this->error_history_pref_.load(&this->error_history_.get_state()) || !this->error_history_.is_consistent())
+            this->error_history_.clear();
+
+        this->publish_error_history();
+    }
+
 /*
     // Not sure if should timeout, or wait forever.
     // Not sure if getting stuck at can_proceed() causes boot failure count to increment
@@ -120,6 +224,47 @@ void FujitsuHalcyonController::setup() {
 */
 }
 
+void FujitsuHalcyonController::reset_transport() {
+#if defined(USE_HOST)
+    // Reopening also recovers a USB adapter that was unplugged and reconnected
+    if (!this->serial_.open(this->port_))
+        ESP_LOGW(TAG, "Failed to reopen %s: %s", this->port_, std::strerror(errno));
+#else
+    // The UART driver belongs to the uart component, so it cannot be reinstalled here.
+    // Discard anything buffered and reapply the mode, which resets the RS485 state.
+    const auto port = static_cast<uart_port_t>(static_cast<uart::IDFUARTComponent*>(this->parent_)->get_hw_serial_number());
+    uart_flush_input(port);
+    if (auto err = uart_set_mode(port, this->uart_mode()); err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to set UART mode: %s", esp_err_to_name(err));
+#endif
+}
+
+#if !defined(USE_HOST)
+// The uart component creates the driver's event queue but never reads it, so it is read here.
+// Every event means received bytes or a receive error, and wakes the loop; errors are also counted.
+// The bytes themselves are still read through the uart component.
+void FujitsuHalcyonController::uart_event_task(void* arg) {
+    auto controller = static_cast<FujitsuHalcyonController*>(arg);
+
+    uart_event_t event;
+    while (true) {
+        if (xQueueReceive(controller->uart_events_, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        switch (event.type) {
+            case UART_PARITY_ERR: controller->uart_parity_errors_++; break;
+            case UART_FRAME_ERR:
+            case UART_BREAK:      controller->uart_framing_errors_++; break;
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL: controller->uart_overruns_++; break;
+            default: break;
+        }
+
+        controller->enable_loop_soon_any_context();
+    }
+}
+#endif
+
 void FujitsuHalcyonController::on_initialization_stage(const fujitsu_general::airstage::h::InitializationStageEnum stage) {
     using fujitsu_general::airstage::h::InitializationStageEnum;
     using stage_t = std::underlying_type_t<InitializationStageEnum>;
@@ -142,7 +287,7 @@ void FujitsuHalcyonController::on_initialization_stage(const fujitsu_general::ai
     auto& features = this->controller->get_features();
 
     // Publish supported features as a human-readable diagnostic string.
-    {
+    if (this->supported_features_sensor != nullptr) {
         char buf[255];
         std::snprintf(buf, sizeof(buf), "Mode: %s%s%s%s%s | Fan: %s%s%s%s%s" "%s%s%s%s%s%s",
             features.Mode.Auto ? " Auto" : "",
@@ -167,50 +312,229 @@ void FujitsuHalcyonController::on_initialization_stage(const fujitsu_general::ai
         this->supported_features_sensor->publish_state(buf);
     }
 
-    if (features.SensorSwitching && this->temperature_sensor_ != nullptr) {
+    if (features.SensorSwitching && this->temperature_sensor_ != nullptr && this->use_sensor_switch != nullptr) {
         this->use_sensor_switch->set_internal(false);
         this->use_sensor_switch->publish_state(this->use_sensor_switch->state);
     }
 
-    if (features.VerticalLouvers) {
+    if (features.VerticalLouvers && this->advance_vertical_louver_button != nullptr) {
         this->advance_vertical_louver_button->set_internal(false);
     }
 
-    if (features.HorizontalLouvers) {
+    if (features.HorizontalLouvers && this->advance_horizontal_louver_button != nullptr) {
         this->advance_horizontal_louver_button->set_internal(false);
     }
 
     if (features.FilterTimer) {
-        this->filter_sensor->set_internal(false);
-        if (this->filter_sensor->has_state())
-            this->filter_sensor->publish_state(this->filter_sensor->state);
-        this->reset_filter_button->set_internal(false);
+        if (this->filter_sensor != nullptr) {
+            this->filter_sensor->set_internal(false);
+            if (this->filter_sensor->has_state())
+                this->filter_sensor->publish_state(this->filter_sensor->state);
+        }
+        if (this->reset_filter_button != nullptr)
+            this->reset_filter_button->set_internal(false);
     }
 }
 
+void FujitsuHalcyonController::publish_statistics() {
+    auto& statistics = this->controller->get_statistics();
+    auto& iu = statistics.IndoorUnitFrames;
+    auto& controller = statistics.ControllerFrames;
+
+    // Loop iterations per second since the last publish
+    const auto now = millis();
+    const auto elapsed = now - this->statistics_time_;
+    const uint32_t loops = elapsed ? static_cast<uint64_t>(this->loop_count_ - this->statistics_loop_count_) * 1000 / elapsed : 0;
+    this->statistics_time_ = now;
+    this->statistics_loop_count_ = this->loop_count_;
+
+    // Counts by packet type: Config/Error/Features/Function/Status
+    char buf[255];
+    std::snprintf(buf, sizeof(buf), "RX: %" PRIu32 " TX: %" PRIu32 " Discarded: %" PRIu32 " Framing: %" PRIu32 " Missed: %" PRIu32 " Timeouts: %" PRIu32 " Conflicts: %" PRIu32 " Collisions: %" PRIu32 " (%" PRIu32 " late echoes) Silences: %" PRIu32 " (%" PRIu32 "/%" PRIu32 " ms) | IU: %" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 " | Controller: %" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 " | Loops: %" PRIu32 "/s",
+        statistics.RxFrames, statistics.TxFrames, statistics.DiscardedBytes, statistics.FramingErrors, statistics.MissedWindows, statistics.InitializationTimeouts, statistics.AddressConflicts,
+        statistics.Collisions, statistics.LateEchoes, statistics.BusSilences, statistics.SilenceDetectTime, statistics.SilenceRecoverTime,
+        iu[0], iu[1], iu[2], iu[3], iu[4],
+        controller[0], controller[1], controller[2], controller[3], controller[4],
+        loops
+    );
+    this->statistics_sensor_->publish_state(buf);
+}
+
+void FujitsuHalcyonController::publish_topology() {
+    auto& topology = this->controller->get_topology();
+    const auto now = this->clock_.now();
+
+    // One entry per controller ever seen: "<address>: <temperature>C [Sensor] W:<writes> <seconds since last frame>s", or Lost
+    char buf[255];
+    size_t length = 0;
+    buf[0] = '\0';
+
+    for (uint8_t address = 0; address <= fujitsu_general::airstage::h::MaxAddress && length < sizeof(buf); address++) {
+        auto& entry = topology[address];
+        if (!entry.Seen)
+            continue;
+
+        const auto age = static_cast<uint32_t>((now - entry.LastSeen) / 1000000);
+        const auto separator = length ? " | " : "";
+        int written;
+        if (topology.is_alive(address, now))
+            written = std::snprintf(buf + length, sizeof(buf) - length, "%s%u: %.1fC%s W:%" PRIu32 " %" PRIu32 "s",
+                separator, address, entry.Temperature.celsius(), entry.UseControllerSensor ? " Sensor" : "", entry.Writes, age);
+        else
+            written = std::snprintf(buf + length, sizeof(buf) - length, "%s%u: Lost %" PRIu32 "s", separator, address, age);
+
+        if (written < 0)
+            break;
+        length += written;
+    }
+
+    this->topology_sensor_->publish_state(length ? buf : "None");
+}
+
+void FujitsuHalcyonController::publish_bus_health() {
+    auto& statistics = this->controller->get_statistics();
+
+#if defined(USE_HOST)
+    const auto line_errors = this->serial_.get_line_errors();
+#else
+    const fujitsu_general::airstage::h::LineErrors line_errors = {
+        .Parity = this->uart_parity_errors_,
+        .Framing = this->uart_framing_errors_,
+        .Overruns = this->uart_overruns_,
+    };
+#endif
+
+    this->bus_health_.update({
+        .Frames = statistics.RxFrames,
+        .DiscardedBytes = statistics.DiscardedBytes,
+        .FramingErrors = statistics.FramingErrors,
+        .Collisions = statistics.Collisions,
+        .Line = line_errors,
+    });
+    auto& interval = this->bus_health_.get_interval();
+
+    if (this->bus_health_sensor_ != nullptr)
+        this->bus_health_sensor_->publish_state(this->bus_health_.get_score());
+
+    // Counts over the last minute
+    if (this->line_errors_sensor_ != nullptr) {
+        char buf[160];
+        std::snprintf(buf, sizeof(buf), "Frames: %" PRIu32 " Discarded: %" PRIu32 " Resync: %" PRIu32 " Collisions: %" PRIu32 " | Parity: %" PRIu32 " Framing: %" PRIu32 " Overruns: %" PRIu32,
+            interval.Frames, interval.DiscardedBytes, interval.FramingErrors, interval.Collisions, interval.Line.Parity, interval.Line.Framing, interval.Line.Overruns);
+        this->line_errors_sensor_->publish_state(buf);
+    }
+}
+
+void FujitsuHalcyonController::dump_unknown_bits() {
+    using fujitsu_general::airstage::h::AddressTypeEnum;
+    using fujitsu_general::airstage::h::PacketTypeEnum;
+    using fujitsu_general::airstage::h::UnknownBits;
+
+    constexpr std::array SourceName = { "IU", "Controller" };
+    constexpr std::array TypeName = { "Config", "Error", "Features", "Function", "Status", "Type 5", "Type 6", "Type 7" };
+
+    if (!this->unknown_bits_)
+        return;
+
+    // One line per byte with any unknown bit set: "<bit>=<count>", most significant bit first
+    ESP_LOGI(TAG, "Unknown bits:");
+    for (size_t source = 0; source < SourceName.size(); source++) {
+        for (size_t type = 0; type < UnknownBits::PacketTypes; type++) {
+            const auto frames = this->unknown_bits_->get_frames(static_cast<AddressTypeEnum>(source), static_cast<PacketTypeEnum>(type));
+            if (!frames)
+                continue;
+
+            ESP_LOGI(TAG, "  %s %s: %" PRIu32 " frames", SourceName[source], TypeName[type], frames);
+
+            for (uint8_t byte = 0; byte < fujitsu_general::airstage::h::Packet::FrameSize; byte++) {
+                char buf[128];
+                size_t length = 0;
+
+                for (int bit = 7; bit >= 0; bit--)
+                    if (auto count = this->unknown_bits_->get_count(static_cast<AddressTypeEnum>(source), static_cast<PacketTypeEnum>(type), byte * 8 + bit))
+                        length += std::snprintf(buf + length, sizeof(buf) - length, " %d=%" PRIu32, bit, count);
+
+                if (length)
+                    ESP_LOGI(TAG, "    Byte %u:%s", byte, buf);
+            }
+        }
+    }
+}
+
+// Built with FUJITSU_HALCYON_TRACING, which climate.py defines when dump_trace is configured
+void FujitsuHalcyonController::dump_trace() {
+#if defined(FUJITSU_HALCYON_TRACING)
+    namespace trace = fujitsu_general::airstage::h::trace;
+
+    // Log2 histograms since the last dump: "2^<n>:<count>" counts durations in [2^n, 2^(n+1))
+    ESP_LOGI(TAG, "Trace (%s):", trace::Unit);
+    for (size_t stage = 0; stage < static_cast<size_t>(trace::StageEnum::MAX); stage++) {
+        char buf[320];
+        trace::format(static_cast<trace::StageEnum>(stage), buf, sizeof(buf));
+        ESP_LOGI(TAG, "  %s", buf);
+    }
+    trace::clear();
+#endif
+}
+
 void FujitsuHalcyonController::log_buffer(const char* dir, const uint8_t* buf, size_t length) {
-    auto tbuf = std::vector<uint8_t>(buf, buf + length);
-    for (auto &b : tbuf)
-        b ^= 0xFF;
+    fujitsu_general::airstage::h::Packet::Buffer tbuf;
+    length = std::min(length, tbuf.size());
+    for (size_t i = 0; i < length; i++)
+        tbuf[i] = buf[i] ^ 0xFF;
 
 #if defined(USE_TZSP)
-    this->tzsp_send(tbuf);
+    // The TZSP sender takes a vector, so captures still allocate
+    this->tzsp_send(std::vector<uint8_t>(tbuf.begin(), tbuf.begin() + length));
 #endif
 
     char pretty_buf[esphome::format_hex_pretty_size(tbuf.size())];
-    esphome::format_hex_pretty_to(pretty_buf, sizeof(pretty_buf), tbuf.data(), tbuf.size(), ' ');
+    esphome::format_hex_pretty_to(pretty_buf, sizeof(pretty_buf), tbuf.data(), length, ' ');
     ESP_LOGD(TAG, "%s: %s", dir, pretty_buf);
 }
 
+// Everything this component allocates, all of it before setup() returns
+size_t FujitsuHalcyonController::entity_bytes() const {
+    size_t buttons = 0;
+    for (auto* button : { this->dump_unknown_bits_button, this->dump_trace_button, this->reset_filter_button,
+            this->advance_vertical_louver_button, this->advance_horizontal_louver_button, this->get_function, this->set_function })
+        buttons += button != nullptr;
+
+    return EntityBytes + buttons * sizeof(custom::CustomButton) +
+        (this->supported_features_sensor != nullptr ? sizeof(text_sensor::TextSensor) : 0) +
+        (this->filter_sensor != nullptr ? sizeof(binary_sensor::BinarySensor) : 0) +
+        (this->use_sensor_switch != nullptr ? sizeof(custom::CustomSwitch) : 0) +
+        (this->function != nullptr ? 3 * sizeof(custom::CustomNumber) : 0);
+}
+
+size_t FujitsuHalcyonController::ram_footprint() const {
+    return sizeof(*this) + this->entity_bytes() + (this->unknown_bits_ ? sizeof(fujitsu_general::airstage::h::UnknownBits) : 0);
+}
+
 void FujitsuHalcyonController::dump_config() {
     LOG_CLIMATE("", "FujitsuHalcyonController", this);
-    ESP_LOGCONFIG(TAG, "  Controller Address: %u (%s)", this->controller_address_, ControllerName[std::clamp(static_cast<size_t>(this->controller_address_), 0u, ControllerName.size() - 1)]);
-    ESP_LOGCONFIG(TAG, "  Remote Temperature Controller Address: %u (%s)", this->temperature_controller_address_, ControllerName[std::clamp(static_cast<size_t>(this->temperature_controller_address_), 0u, ControllerName.size() - 1)]);
+    const auto controller_address = this->controller->get_controller_address();
+    ESP_LOGCONFIG(TAG, "  Controller Address: %u (%s)%s", controller_address, ControllerName[std::min<size_t>(controller_address, ControllerName.size() - 1)],
+        !this->auto_address_ ? "" : this->controller->is_discovering() ? " (auto, discovering)" : " (auto)");
+    if (this->auto_temperature_controller_address_)
+        ESP_LOGCONFIG(TAG, "  Remote Temperature Controller Address: auto");
+    else
+        ESP_LOGCONFIG(TAG, "  Remote Temperature Controller Address: %u (%s)", this->temperature_controller_address_, ControllerName[std::min<size_t>(this->temperature_controller_address_, ControllerName.size() - 1)]);
     LOG_SENSOR("  ", "Remote Temperature Controller Sensor", this->remote_sensor);
     LOG_SENSOR("  ", "Temperature Sensor", this->temperature_sensor_);
     LOG_SENSOR("  ", "Humidity Sensor", this->humidity_sensor_);
     ESP_LOGCONFIG(TAG, "  Ignore Lock: %s", this->ignore_lock_ ? "YES" : "NO");
+    ESP_LOGCONFIG(TAG, "  Listen Only: %s", this->listen_only_ ? "YES" : "NO");
+    ESP_LOGCONFIG(TAG, "  Verify Echo: %s", this->verify_echo_ ? "YES" : "NO");
+    LOG_TEXT_SENSOR("  ", "Statistics", this->statistics_sensor_);
+    LOG_TEXT_SENSOR("  ", "Error History", this->error_history_sensor_);
+    LOG_TEXT_SENSOR("  ", "Runtime", this->runtime_sensor_);
+    LOG_TEXT_SENSOR("  ", "Topology", this->topology_sensor_);
+    LOG_SENSOR("  ", "Bus Health", this->bus_health_sensor_);
+    LOG_TEXT_SENSOR("  ", "Line Errors", this->line_errors_sensor_);
     ESP_LOGCONFIG(TAG, "  Standby Mode: %s", this->standby_sensor->state ? "ACTIVE" : "NORMAL");
+    ESP_LOGCONFIG(TAG, "  RAM: %zu bytes (controller %zu, unknown bits %zu, entities %zu)", this->ram_footprint(),
+        sizeof(fujitsu_general::airstage::h::Controller), this->unknown_bits_ ? sizeof(fujitsu_general::airstage::h::UnknownBits) : 0, this->entity_bytes());
 
     if (this->controller->is_initialized()) {
         auto& features = this->controller->get_features();
@@ -224,21 +548,25 @@ void FujitsuHalcyonController::dump_config() {
             ESP_LOGCONFIG(TAG, "    - Sensor Switching");
     }
 
-    if (!this->filter_sensor->is_internal())
+    if (this->filter_sensor != nullptr && !this->filter_sensor->is_internal())
         ESP_LOGCONFIG(TAG, "  Filter Timer: %s", this->filter_sensor->state ? "EXPIRED" : "OK");
-    if (!this->use_sensor_switch->is_internal())
+    if (this->use_sensor_switch != nullptr && !this->use_sensor_switch->is_internal())
         ESP_LOGCONFIG(TAG, "  Use Temperature Sensor: %s", this->use_sensor_switch->state ? "YES" : "NO");
 
 #if defined(USE_TZSP)
     LOG_TZSP("  ", this);
 #endif
 
+#if defined(USE_HOST)
+    ESP_LOGCONFIG(TAG, "  Port: %s", this->port_);
+#else
     this->check_uart_settings(
         fujitsu_general::airstage::h::UARTConfig.baud_rate,
         this->uart_stop_bits_to_uart_config_stop_bits(fujitsu_general::airstage::h::UARTConfig.stop_bits),
         this->uart_parity_to_uart_config_parity(fujitsu_general::airstage::h::UARTConfig.parity),
         this->uart_data_bits_to_uart_config_data_bits(fujitsu_general::airstage::h::UARTConfig.data_bits)
     );
+#endif
 
     this->dump_traits_(TAG);
 }
@@ -312,46 +640,107 @@ void FujitsuHalcyonController::control(const climate::ClimateCall& call) {
     using climate::ClimatePreset;
     using climate::ClimateSwingMode;
 
+    // Accepted changes are published immediately and held as pending until the indoor unit reports them.
+    // Rejected changes (lock, unsupported feature, out of range) leave the published state as it was.
+    auto& pending = this->pending_control_;
+    char rejected[64] = "";
+    auto accept = [&rejected](bool accepted, const char* field) {
+        if (!accepted)
+            std::snprintf(rejected + std::strlen(rejected), sizeof(rejected) - std::strlen(rejected), " %s", field);
+        return accepted;
+    };
+
     // Target temperature / Setpoint
-    if (call.get_target_temperature().has_value())
-        this->controller->set_setpoint(call.get_target_temperature().value(), this->ignore_lock_);
+    if (call.get_target_temperature().has_value()) {
+        const uint8_t setpoint = call.get_target_temperature().value();
+        if (accept(this->controller->set_setpoint(setpoint, this->ignore_lock_), "Setpoint")) {
+            this->target_temperature = setpoint;
+            pending.TargetTemperature = setpoint;
+        }
+    }
 
     // Economy mode
-    if (call.get_preset().has_value())
-        this->controller->set_economy(call.get_preset().value() == ClimatePreset::CLIMATE_PRESET_ECO, this->ignore_lock_);
+    if (call.get_preset().has_value()) {
+        const auto preset = call.get_preset().value() == ClimatePreset::CLIMATE_PRESET_ECO ? ClimatePreset::CLIMATE_PRESET_ECO : ClimatePreset::CLIMATE_PRESET_NONE;
+        if (accept(this->controller->set_economy(preset == ClimatePreset::CLIMATE_PRESET_ECO, this->ignore_lock_), "Preset")) {
+            this->preset = preset;
+            pending.Preset = preset;
+        }
+    }
 
     // Fan mode / speed
-    if (call.get_fan_mode().has_value())
-        this->controller->set_fan_speed(climate_fan_mode_to_fan_speed(call.get_fan_mode().value()), this->ignore_lock_);
+    if (call.get_fan_mode().has_value()) {
+        const auto fan_mode = call.get_fan_mode().value();
+        if (accept(this->controller->set_fan_speed(climate_fan_mode_to_fan_speed(fan_mode), this->ignore_lock_), "Fan")) {
+            this->fan_mode = fan_mode;
+            pending.FanMode = fan_mode;
+        }
+    }
 
-    // Mode / enabled
+    // Mode / enabled. The mode is checked first so a rejected mode does not still switch the unit on.
     if (call.get_mode().has_value()) {
-        if (call.get_mode().value() == ClimateMode::CLIMATE_MODE_OFF)
-            this->controller->set_enabled(false, this->ignore_lock_);
-        else {
-            this->controller->set_enabled(true, this->ignore_lock_);
-            this->controller->set_mode(climate_mode_to_mode(call.get_mode().value()), this->ignore_lock_);
+        const auto mode = call.get_mode().value();
+        const auto accepted = mode == ClimateMode::CLIMATE_MODE_OFF ?
+            this->controller->set_enabled(false, this->ignore_lock_) :
+            this->controller->can_set_mode(climate_mode_to_mode(mode), this->ignore_lock_) &&
+                this->controller->set_enabled(true, this->ignore_lock_) && this->controller->set_mode(climate_mode_to_mode(mode), this->ignore_lock_);
+        if (accept(accepted, "Mode")) {
+            this->mode = mode;
+            pending.Mode = mode;
         }
     }
 
     // Swing mode
     if (call.get_swing_mode().has_value()) {
+        // Each axis is set on its own. An axis the unit has no louvers for is refused without
+        // rejecting the call; a refused axis keeps its current state while the other is queued.
+        const auto& features = this->controller->get_features();
         const auto swing_mode = climate_swing_mode_to_swing_mode(call.get_swing_mode().value());
-        this->controller->set_horizontal_swing(swing_mode.first, this->ignore_lock_);
-        this->controller->set_vertical_swing(swing_mode.second, this->ignore_lock_);
+        const auto current = climate_swing_mode_to_swing_mode(this->swing_mode);
+        const auto horizontal = this->controller->set_horizontal_swing(swing_mode.first, this->ignore_lock_);
+        const auto vertical = this->controller->set_vertical_swing(swing_mode.second, this->ignore_lock_);
+        accept(horizontal || !features.HorizontalLouvers, "Horizontal Swing");
+        accept(vertical || !features.VerticalLouvers, "Vertical Swing");
+        if (horizontal || vertical) {
+            this->swing_mode = swing_mode_to_climate_swing_mode(horizontal ? swing_mode.first : current.first, vertical ? swing_mode.second : current.second);
+            pending.SwingMode = this->swing_mode;
+        }
     }
 
+    if (rejected[0])
+        ESP_LOGW(TAG, "Rejected:%s", rejected);
+
+    // Restarted by every call, so a burst of changes is confirmed (or rolled back) together
+    if (pending.TargetTemperature || pending.Preset || pending.FanMode || pending.Mode || pending.SwingMode)
+        this->set_timeout("pending_control", PendingControlTimeout, [this]() { this->roll_back_control(); });
+
     this->publish_state();
 }
 
-void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstage::h::Config& data) {
-    using climate::ClimateFanMode;
-    using climate::ClimateMode;
-    using climate::ClimatePreset;
-    using climate::ClimateSwingMode;
+void FujitsuHalcyonController::roll_back_control() {
+    auto& pending = this->pending_control_;
+    char rolled_back[64];
+    std::snprintf(rolled_back, sizeof(rolled_back), "%s%s%s%s%s",
+        pending.TargetTemperature ? " Setpoint" : "", pending.Preset ? " Preset" : "", pending.FanMode ? " Fan" : "",
+        pending.Mode ? " Mode" : "", pending.SwingMode ? " Swing" : "");
+
+    if (!rolled_back[0])
+        return;
+
+    ESP_LOGW(TAG, "Not applied by the indoor unit, rolling back:%s", rolled_back);
+    pending = {};
+
+    if (this->have_device_config_ && this->update_climate_from_device(this->device_config_))
+        this->publish_state();
+}
 
+void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstage::h::Config& data) {
+    FUJITSU_HALCYON_TRACE(Publish);
     auto need_to_publish = false;
 
+    if (this->runtime_sensor_ != nullptr)
+        this->runtime_.update(data, this->clock_.now());
+
     // Error sensor (binary)
     if (!this->error_sensor->has_state())
         this->error_sensor->publish_state(data.IndoorUnit.Error);
@@ -360,50 +749,74 @@ void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstag
     if (!this->error_code_sensor->has_state() && !data.IndoorUnit.Error)
         this->error_code_sensor->publish_state("");
 
+    // Error cleared without an Error packet reporting it
+    if (this->error_history_sensor_ != nullptr && !data.IndoorUnit.Error && this->error_history_.clear_error(this->error_time())) {
+        this->error_history_pref_.save(&this->error_history_.get_state());
+        this->publish_error_history();
+    }
+
     // Standby mode sensor
     // This can indicate defrosting, performing oil recovery, waiting for other units to complete....
     if (!this->standby_sensor->has_state() || data.IndoorUnit.StandbyMode != this->standby_sensor->state)
         this->standby_sensor->publish_state(data.IndoorUnit.StandbyMode);
 
     // Filter sensor
-    if (this->controller->get_features().FilterTimer && (!this->filter_sensor->has_state() || data.IndoorUnit.FilterTimerExpired != this->filter_sensor->state))
+    if (this->filter_sensor != nullptr && this->controller->get_features().FilterTimer && (!this->filter_sensor->has_state() || data.IndoorUnit.FilterTimerExpired != this->filter_sensor->state))
         this->filter_sensor->publish_state(data.IndoorUnit.FilterTimerExpired);
 
-    // Target temperature / Setpoint
-    if (data.Setpoint != this->target_temperature) {
-        this->target_temperature = data.Setpoint;
+    this->device_config_ = data;
+    this->have_device_config_ = true;
+
+    if (this->update_climate_from_device(data))
         need_to_publish = true;
+
+    if (need_to_publish)
+        this->publish_state();
+}
+
+// Fields with a pending control() request keep the requested value until the indoor unit reports it,
+// so the published state does not flip back while the change is on its way.
+template<typename T, typename V>
+static bool confirm(std::optional<T>& pending, const T& device, V& value) {
+    if (pending) {
+        if (*pending != device)
+            return false;
+        pending.reset();
     }
 
+    if (value == device)
+        return false;
+
+    value = device;
+    return true;
+}
+
+bool FujitsuHalcyonController::update_climate_from_device(const fujitsu_general::airstage::h::Config& data) {
+    using climate::ClimateMode;
+    using climate::ClimatePreset;
+
+    auto& pending = this->pending_control_;
+    auto changed = false;
+
+    // Target temperature / Setpoint
+    changed |= confirm(pending.TargetTemperature, static_cast<float>(data.Setpoint), this->target_temperature);
+
     // Economy mode
-    if (data.Economy != (this->preset == ClimatePreset::CLIMATE_PRESET_ECO)) {
-        this->preset = data.Economy ? ClimatePreset::CLIMATE_PRESET_ECO : ClimatePreset::CLIMATE_PRESET_NONE;
-        need_to_publish = true;
-    }
+    changed |= confirm(pending.Preset, data.Economy ? ClimatePreset::CLIMATE_PRESET_ECO : ClimatePreset::CLIMATE_PRESET_NONE, this->preset);
 
     // Fan mode / speed
-    const auto fan_mode = fan_speed_to_climate_fan_mode(data.FanSpeed);
-    if (fan_mode != this->fan_mode) {
-        this->fan_mode = fan_mode;
-        need_to_publish = true;
-    }
+    changed |= confirm(pending.FanMode, fan_speed_to_climate_fan_mode(data.FanSpeed), this->fan_mode);
 
     // Mode / enabled
-    const auto mode = data.Enabled ? mode_to_climate_mode(data.Mode) : ClimateMode::CLIMATE_MODE_OFF;
-    if (mode != this->mode) {
-        this->mode = mode;
-        need_to_publish = true;
-    }
+    changed |= confirm(pending.Mode, data.Enabled ? mode_to_climate_mode(data.Mode) : ClimateMode::CLIMATE_MODE_OFF, this->mode);
 
     // Swing mode
-    const auto swing_mode = swing_mode_to_climate_swing_mode(data.SwingHorizontal, data.SwingVertical);
-    if (swing_mode != this->swing_mode) {
-        this->swing_mode = swing_mode;
-        need_to_publish = true;
-    }
+    changed |= confirm(pending.SwingMode, swing_mode_to_climate_swing_mode(data.SwingHorizontal, data.SwingVertical), this->swing_mode);
 
-    if (need_to_publish)
-        this->publish_state();
+    if (!pending.TargetTemperature && !pending.Preset && !pending.FanMode && !pending.Mode && !pending.SwingMode)
+        this->cancel_timeout("pending_control");
+
+    return changed;
 }
 
 void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstage::h::Packet& data) {
@@ -412,6 +825,8 @@ void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstag
     // Error packet
     if (data.Type == PacketTypeEnum::Error)
     {
+        this->record_error(data);
+
         // Error sensor (boolean)
         if (!data.Error.ErrorCode == this->error_sensor->state)
             this->error_sensor->publish_state(data.Error.ErrorCode);
@@ -423,41 +838,170 @@ void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstag
                 this->error_code_sensor->publish_state("");
             else
             {
-                const auto error_bytes = std::to_array<uint8_t>({ data.SourceAddress, data.Error.ErrorCode });
-                const auto error_buf_len = esphome::format_hex_pretty_size(error_bytes.size());
-                constexpr auto extended_error_buf_len = 4;
-
-                char error_buf[error_buf_len + extended_error_buf_len];
-                esphome::format_hex_pretty_to(error_buf, error_bytes, ' ');
-
-                if (data.Error.ErrorCodeExtended)
-                    std::sprintf(error_buf + error_buf_len - 1, ".%u", data.Error.ErrorCodeExtended);
-
-                // NOTE: Error codes D? appear to be remapped to J?, but maybe not in all cases?
-                if ((data.Error.ErrorCode & 0xF0) == 0xD0)
-                    error_buf[3] = 'J';
-
+                char error_buf[16];
+                format_error_code(error_buf, sizeof(error_buf), data.SourceAddress, data.Error.ErrorCode, data.Error.ErrorCodeExtended);
                 this->error_code_sensor->publish_state(error_buf);
             }
         }
     }
 }
 
+// Only requested by the function entities, so they exist
 void FujitsuHalcyonController::update_from_device(const fujitsu_general::airstage::h::Function& data) {
     this->function->publish_state(data.Function);
     this->function_value->publish_state(data.Value);
     this->function_unit->publish_state(data.Unit);
 }
 
+void FujitsuHalcyonController::on_safe_shutdown() {
+    if (this->runtime_sensor_ != nullptr)
+        this->runtime_pref_.save(&this->runtime_.get_state());
+}
+
+// Hours, "On <h> | <mode> <h>... | <fan speed> <h>... | Standby <h> | Error <h>", omitting modes and fan speeds never used
+void FujitsuHalcyonController::publish_runtime() {
+    constexpr std::array ModeName = { "Fan", "Dry", "Cool", "Heat", "Auto" };
+    constexpr std::array FanSpeedName = { "Auto", "Quiet", "Low", "Medium", "High" };
+
+    const auto& state = this->runtime_.get_state();
+    char buf[256];
+    size_t length = 0;
+
+    auto append = [&](const char* separator, const char* name, uint32_t seconds) {
+        if (length < sizeof(buf))
+            length += std::snprintf(buf + length, sizeof(buf) - length, "%s%s %.1fh", separator, name, seconds / 3600.0f);
+    };
+
+    append("", "On", state.Enabled);
+    const char* separator = " | ";
+    for (size_t i = 0; i < state.Mode.size(); i++)
+        if (state.Mode[i]) {
+            append(separator, ModeName[i], state.Mode[i]);
+            separator = " ";
+        }
+    separator = " | ";
+    for (size_t i = 0; i < state.FanSpeed.size(); i++)
+        if (state.FanSpeed[i]) {
+            append(separator, FanSpeedName[i], state.FanSpeed[i]);
+            separator = " ";
+        }
+    append(" | ", "Standby", state.Standby);
+    append(" | ", "Error", state.Error);
+
+    this->runtime_sensor_->publish_state(buf);
+}
+
+void FujitsuHalcyonController::format_error_code(char* buf, size_t length, uint8_t address, uint8_t code, uint8_t extended) {
+    auto n = std::snprintf(buf, length, "%02X %02X", address, code);
+
+    if (extended && n > 0 && static_cast<size_t>(n) < length)
+        std::snprintf(buf + n, length - n, ".%u", extended);
+
+    // NOTE: Error codes D? appear to be remapped to J?, but maybe not in all cases?
+    if ((code & 0xF0) == 0xD0 && length > 3)
+        buf[3] = 'J';
+}
+
+uint32_t FujitsuHalcyonController::error_time() {
+#if defined(USE_TIME)
+    if (this->time_ != nullptr) {
+        auto now = this->time_->now();
+        if (now.is_valid())
+            return now.timestamp;
+    }
+#endif
+
+    return 0;
+}
+
+void FujitsuHalcyonController::record_error(const fujitsu_general::airstage::h::Packet& data) {
+    if (this->error_history_sensor_ == nullptr)
+        return;
+
+    const auto changed = data.Error.ErrorCode ?
+        this->error_history_.set_error(data.SourceAddress, data.Error.ErrorCode, data.Error.ErrorCodeExtended, this->error_time()) :
+        this->error_history_.clear_error(this->error_time());
+
+    if (changed) {
+        this->error_history_pref_.save(&this->error_history_.get_state());
+        this->publish_error_history();
+    }
+}
+
+// Newest first, "<address> <code>[.<extended>] [x<count>] <start> <duration|active>", as many as fit in a state
+void FujitsuHalcyonController::publish_error_history() {
+    constexpr size_t MaxStateLength = 255;
+
+    char buf[MaxStateLength + 1] = "";
+    size_t length = 0;
+    for (size_t i = 0; i < this->error_history_.size(); i++) {
+        const auto& record = this->error_history_[i];
+        char entry[64];
+        char code[16];
+        char start[16] = "?";
+        char duration[16] = "active";
+
+        format_error_code(code, sizeof(code), record.Address, record.Code, record.Extended);
+
+#if defined(USE_TIME)
+        if (record.Start)
+            ESPTime::from_epoch_local(record.Start).strftime(start, sizeof(start), "%m-%d %H:%M");
+#endif
+
+        if (!record.Active) {
+            if (!record.Start || !record.End)
+                std::snprintf(duration, sizeof(duration), "ended");
+            else if (auto seconds = record.End - record.Start; seconds < 3600)
+                std::snprintf(duration, sizeof(duration), "%" PRIu32 "m", seconds / 60);
+            else if (seconds < 86400)
+                std::snprintf(duration, sizeof(duration), "%" PRIu32 "h", seconds / 3600);
+            else
+                std::snprintf(duration, sizeof(duration), "%" PRIu32 "d", seconds / 86400);
+        }
+
+        int written;
+        if (record.Count > 1)
+            written = std::snprintf(entry, sizeof(entry), "%s%s x%u %s %s", length ? "; " : "", code, record.Count, start, duration);
+        else
+            written = std::snprintf(entry, sizeof(entry), "%s%s %s %s", length ? "; " : "", code, start, duration);
+
+        // Whole entries only
+        if (written < 0 || length + std::min<size_t>(written, sizeof(entry) - 1) > MaxStateLength)
+            break;
+        length += std::snprintf(buf + length, sizeof(buf) - length, "%s", entry);
+    }
+
+    this->error_history_sensor_->publish_state(buf);
+}
+
+void FujitsuHalcyonController::read_function(uint8_t function, uint8_t unit, FunctionCallback callback) {
+    this->controller->get_function(function, unit, [callback = std::move(callback)](bool success, const fujitsu_general::airstage::h::Function& data) {
+        if (callback)
+            callback(success, data.Value);
+    });
+}
+
+void FujitsuHalcyonController::write_function(uint8_t function, uint8_t value, uint8_t unit, FunctionCallback callback) {
+    this->controller->set_function(function, value, unit, [callback = std::move(callback)](bool success, const fujitsu_general::airstage::h::Function& data) {
+        if (callback)
+            callback(success, data.Value);
+    });
+}
+
 void FujitsuHalcyonController::update_from_controller(const uint8_t address, const fujitsu_general::airstage::h::Config& data) {
-    if (address == this->temperature_controller_address_ && data.Controller.Temperature) {
+    // In auto mode the lowest live controller reporting a temperature is used, so a lost controller is replaced by the next
+    const bool temperature_source = this->auto_temperature_controller_address_ ?
+        address == this->controller->get_topology().temperature_source(this->clock_.now()) :
+        address == this->temperature_controller_address_;
+
+    if (temperature_source && data.Controller.Temperature) {
         // Make remote controllers sensor visible on first data received
         if (this->remote_sensor->is_internal())
             this->remote_sensor->set_internal(false);
 
         // Update remote controllers sensor component with remote controllers reported temperature
-        if (data.Controller.Temperature != this->remote_sensor->get_raw_state())
-            this->remote_sensor->publish_state(data.Controller.Temperature);
+        if (const auto temperature = data.Controller.Temperature.celsius(); temperature != this->remote_sensor->get_raw_state())
+            this->remote_sensor->publish_state(temperature);
     }
 }
 
@@ -553,6 +1097,7 @@ constexpr std::pair<bool, bool> FujitsuHalcyonController::climate_swing_mode_to_
     }
 }
 
+#if !defined(USE_HOST)
 constexpr uint8_t FujitsuHalcyonController::uart_data_bits_to_uart_config_data_bits(uart_word_length_t bits) {
     switch (bits) {
         case UART_DATA_5_BITS: return 5;
@@ -580,5 +1125,6 @@ constexpr uart::UARTParityOptions FujitsuHalcyonController::uart_parity_to_uart_
         default:                return uart::UART_CONFIG_PARITY_NONE;
     }
 }
+#endif
 
 }
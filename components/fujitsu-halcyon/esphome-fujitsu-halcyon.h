@@ -1,14 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <optional>
 
 #include <esphome/core/component.h>
+#include <esphome/core/preferences.h>
 #include <esphome/components/binary_sensor/binary_sensor.h>
 #include <esphome/components/climate/climate.h>
 #include <esphome/components/sensor/sensor.h>
 #include <esphome/components/text_sensor/text_sensor.h>
+
+#if !defined(USE_HOST)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esphome/components/uart/uart.h>
 #include <esphome/components/uart/uart_component_esp_idf.h>
+#endif
+
+#if defined(USE_TIME)
+#include <esphome/components/time/real_time_clock.h>
+#endif
 
 #if defined(USE_TZSP)
 #include <esphome/components/tzsp/tzsp.h>
@@ -17,64 +30,144 @@
 #include "esphome-custom-button.h"
 #include "esphome-custom-number.h"
 #include "esphome-custom-switch.h"
+#include "BusHealth.h"
 #include "Controller.h"
+#include "ErrorHistory.h"
+#include "Runtime.h"
+#include "UnknownBits.h"
+
+#if defined(USE_HOST)
+#include "HostSerial.h"
+#endif
 
 namespace esphome::fujitsu_general_airstage_h_controller {
 
+class FujitsuHalcyonController : public Component, public climate::Climate
+#if !defined(USE_HOST)
+    , public uart::UARTDevice
+#endif
 #if defined(USE_TZSP)
-class FujitsuHalcyonController : public Component, public climate::Climate, public uart::UARTDevice, public tzsp::TZSPSender {
-#else
-class FujitsuHalcyonController : public Component, public climate::Climate, public uart::UARTDevice {
+    , public tzsp::TZSPSender
 #endif
+{
     public:
         binary_sensor::BinarySensor* standby_sensor = new binary_sensor::BinarySensor();
-        binary_sensor::BinarySensor* filter_sensor = new binary_sensor::BinarySensor();
         binary_sensor::BinarySensor* error_sensor = new binary_sensor::BinarySensor();
         binary_sensor::BinarySensor* connected_sensor = new binary_sensor::BinarySensor();
         text_sensor::TextSensor* error_code_sensor = new text_sensor::TextSensor();
         text_sensor::TextSensor* initialization_sensor = new text_sensor::TextSensor();
-        text_sensor::TextSensor* supported_features_sensor = new text_sensor::TextSensor();
         sensor::Sensor* remote_sensor = new sensor::Sensor();
 
         custom::CustomButton* reinitialize_button = new custom::CustomButton([this]() { this->controller->reinitialize(); });
-        custom::CustomButton* reset_filter_button = new custom::CustomButton([this]() { this->controller->reset_filter(this->ignore_lock_); });
-        custom::CustomButton* advance_vertical_louver_button = new custom::CustomButton([this]() { this->controller->advance_vertical_louver(this->ignore_lock_); });
-        custom::CustomButton* advance_horizontal_louver_button = new custom::CustomButton([this]() { this->controller->advance_horizontal_louver(this->ignore_lock_); });
-        custom::CustomSwitch* use_sensor_switch = new custom::CustomSwitch([this](bool state) { return this->controller->use_sensor(state, this->ignore_lock_); });
-
-        custom::CustomNumber* function = new custom::CustomNumber([this](float state) { return int(state); });
-        custom::CustomNumber* function_value = new custom::CustomNumber([this](float state) { return int(state); });
-        custom::CustomNumber* function_unit = new custom::CustomNumber([this](float state) { return int(state); });
-        custom::CustomButton* get_function = new custom::CustomButton([this]() {
-            if (this->function->has_state() && this->function_unit->has_state()) {
-                this->function_value->publish_state(NAN);
-                this->controller->get_function(this->function->state, this->function_unit->state);
-            }
-        });
-        custom::CustomButton* set_function = new custom::CustomButton([this]() {
-            if (this->function->has_state() && this->function_value->has_state() && this->function_unit->has_state())
-                this->controller->set_function(this->function->state, this->function_value->state, this->function_unit->state);
-        });
 
+        // Created by to_code() only when configured, or when the features they depend on are possible
+        text_sensor::TextSensor* supported_features_sensor{};
+        binary_sensor::BinarySensor* filter_sensor{};
+        custom::CustomButton* dump_unknown_bits_button{};
+        custom::CustomButton* dump_trace_button{};
+        custom::CustomButton* reset_filter_button{};
+        custom::CustomButton* advance_vertical_louver_button{};
+        custom::CustomButton* advance_horizontal_louver_button{};
+        custom::CustomSwitch* use_sensor_switch{};
+
+        text_sensor::TextSensor* create_supported_features_sensor() { return this->supported_features_sensor = new text_sensor::TextSensor(); }
+        binary_sensor::BinarySensor* create_filter_sensor() { return this->filter_sensor = new binary_sensor::BinarySensor(); }
+        custom::CustomButton* create_dump_unknown_bits_button() {
+            return this->dump_unknown_bits_button = new custom::CustomButton([this]() { this->dump_unknown_bits(); });
+        }
+        custom::CustomButton* create_dump_trace_button() {
+            return this->dump_trace_button = new custom::CustomButton([this]() { this->dump_trace(); });
+        }
+        custom::CustomButton* create_reset_filter_button() {
+            return this->reset_filter_button = new custom::CustomButton([this]() { this->controller->reset_filter(this->ignore_lock_); });
+        }
+        custom::CustomButton* create_advance_vertical_louver_button() {
+            return this->advance_vertical_louver_button = new custom::CustomButton([this]() { this->controller->advance_vertical_louver(this->ignore_lock_); });
+        }
+        custom::CustomButton* create_advance_horizontal_louver_button() {
+            return this->advance_horizontal_louver_button = new custom::CustomButton([this]() { this->controller->advance_horizontal_louver(this->ignore_lock_); });
+        }
+        custom::CustomSwitch* create_use_sensor_switch() {
+            return this->use_sensor_switch = new custom::CustomSwitch([this](bool state) { return this->controller->use_sensor(state, this->ignore_lock_); });
+        }
+
+        // Function register entities, created together
+        custom::CustomNumber* function{};
+        custom::CustomNumber* function_value{};
+        custom::CustomNumber* function_unit{};
+        custom::CustomButton* get_function{};
+        custom::CustomButton* set_function{};
+
+        void create_function_entities() {
+            this->function = new custom::CustomNumber([this](float state) { return int(state); });
+            this->function_value = new custom::CustomNumber([this](float state) { return int(state); });
+            this->function_unit = new custom::CustomNumber([this](float state) { return int(state); });
+            this->get_function = new custom::CustomButton([this]() {
+                if (this->function->has_state() && this->function_unit->has_state()) {
+                    this->function_value->publish_state(NAN);
+                    this->controller->get_function(this->function->state, this->function_unit->state,
+                        [this](bool success, const fujitsu_general::airstage::h::Function& data) { if (success) this->update_from_device(data); });
+                }
+            });
+            this->set_function = new custom::CustomButton([this]() {
+                if (this->function->has_state() && this->function_value->has_state() && this->function_unit->has_state())
+                    this->controller->set_function(this->function->state, this->function_value->state, this->function_unit->state,
+                        [this](bool success, const fujitsu_general::airstage::h::Function& data) { if (success) this->update_from_device(data); });
+            });
+        }
+
+#if defined(USE_HOST)
+        FujitsuHalcyonController(uint8_t controller_address) : controller_address_(controller_address) {}
+
+        void set_port(const char* port) { this->port_ = port; }
+        void set_local_echo(bool local_echo) { this->serial_.set_local_echo(local_echo); }
+#else
         FujitsuHalcyonController(uart::IDFUARTComponent *parent, uint8_t controller_address) : uart::UARTDevice(parent), controller_address_(controller_address) {}
+#endif
 
         void loop() override;
         void setup() override;
         void dump_config() override;
+        void on_safe_shutdown() override;
         float get_setup_priority() const override { return esphome::setup_priority::DATA; }
 //        bool can_proceed() { return this->is_failed() || this->controller->is_initialized(); }
 
         void control(const climate::ClimateCall& call) override;
         climate::ClimateTraits traits() override;
 
+        // Function register access for lambdas. The callback receives the value from the matching
+        // reply, or success = false if the indoor unit did not reply after retries. It is stored
+        // without allocating, so may capture up to four pointers.
+        using FunctionCallback = fujitsu_general::airstage::h::InplaceFunction<void(bool success, uint8_t value), 4 * sizeof(void*)>;
+        void read_function(uint8_t function, uint8_t unit, FunctionCallback callback);
+        void write_function(uint8_t function, uint8_t value, uint8_t unit, FunctionCallback callback = {});
+
         void set_ignore_lock(bool ignore_lock) { this->ignore_lock_ = ignore_lock; }
+        void set_listen_only(bool listen_only) { this->listen_only_ = listen_only; }
+        void set_verify_echo(bool verify_echo) { this->verify_echo_ = verify_echo; }
+        void set_auto_address(bool auto_address) { this->auto_address_ = auto_address; }
+        void set_diagnostics_interval(uint32_t diagnostics_interval) { this->diagnostics_interval_ = diagnostics_interval; }
+        void set_statistics_sensor(text_sensor::TextSensor* statistics_sensor) { this->statistics_sensor_ = statistics_sensor; }
+        void set_runtime_sensor(text_sensor::TextSensor* runtime_sensor) { this->runtime_sensor_ = runtime_sensor; }
+        void set_runtime_save_interval(uint32_t runtime_save_interval) { this->runtime_save_interval_ = runtime_save_interval; }
+        void set_error_history_sensor(text_sensor::TextSensor* error_history_sensor) { this->error_history_sensor_ = error_history_sensor; }
+#if defined(USE_TIME)
+        void set_time(time::RealTimeClock* time) { this->time_ = time; }
+#endif
         void set_humidity_sensor(sensor::Sensor* humidity_sensor) { this->humidity_sensor_ = humidity_sensor; }
         void set_temperature_sensor(sensor::Sensor* temperature_sensor) { this->temperature_sensor_ = temperature_sensor; }
         void set_temperature_controller_address(uint8_t temperature_controller_address) { this->temperature_controller_address_ = temperature_controller_address; }
+        void set_auto_temperature_controller_address(bool auto_temperature_controller_address) { this->auto_temperature_controller_address_ = auto_temperature_controller_address; }
+        void set_track_unknown_bits(bool track_unknown_bits) { this->track_unknown_bits_ = track_unknown_bits; }
+        void set_topology_sensor(text_sensor::TextSensor* topology_sensor) { this->topology_sensor_ = topology_sensor; }
+        void set_bus_health_sensor(sensor::Sensor* bus_health_sensor) { this->bus_health_sensor_ = bus_health_sensor; }
+        void set_line_errors_sensor(text_sensor::TextSensor* line_errors_sensor) { this->line_errors_sensor_ = line_errors_sensor; }
 
+#if !defined(FUJITSU_HALCYON_FEATURES)
         // Feature negotiation overrides (called from to_code() in climate.py).
         // Setters mutate features_override_ in place; fields not touched keep the
         // DefaultFeatures value the struct was initialized with.
+        // With autoconf off the features are fixed at build time instead.
         void set_autoconf(bool v) { this->autoconf_ = v; }
         void set_supported_modes(bool a, bool h, bool f, bool d, bool c) {
             this->features_override_.Mode.Auto = a;
@@ -98,30 +191,123 @@ class FujitsuHalcyonController : public Component, public climate::Climate, publ
         void set_sensor_switching(bool v) { this->features_override_.SensorSwitching = v; }
         void set_maintenance(bool v)      { this->features_override_.Maintenance     = v; }
         void set_economy_mode(bool v)     { this->features_override_.EconomyMode     = v; }
+#endif
 
     protected:
         uint8_t controller_address_{};
         uint8_t temperature_controller_address_{};
+        bool auto_temperature_controller_address_{};
         bool ignore_lock_{};
+        bool listen_only_{};
+        bool verify_echo_{};
+        bool auto_address_{};
+        bool track_unknown_bits_{};
+        uint32_t diagnostics_interval_{};
         sensor::Sensor* humidity_sensor_{};
         sensor::Sensor* temperature_sensor_{};
+        text_sensor::TextSensor* statistics_sensor_{};
+        text_sensor::TextSensor* error_history_sensor_{};
+        text_sensor::TextSensor* runtime_sensor_{};
+        text_sensor::TextSensor* topology_sensor_{};
+        sensor::Sensor* bus_health_sensor_{};
+        text_sensor::TextSensor* line_errors_sensor_{};
+        uint32_t runtime_save_interval_{};
+#if defined(USE_TIME)
+        time::RealTimeClock* time_{};
+#endif
 
+#if !defined(FUJITSU_HALCYON_FEATURES)
         // Feature negotiation state. Initialized to DefaultFeatures so anything not
         // overridden by YAML keeps the in-code default. Applied to Controller in setup().
         bool autoconf_ = true;
         fujitsu_general::airstage::h::Features features_override_ = fujitsu_general::airstage::h::DefaultFeatures;
+#endif
 
     private:
-        fujitsu_general::airstage::h::Controller* controller;
+#if defined(USE_HOST)
+        fujitsu_general::airstage::h::SteadyClock clock_;
+        fujitsu_general::airstage::h::HostSerial serial_;
+        const char* port_{};
+
+        // Same interface as uart::UARTDevice, so the Controller transport callbacks are shared
+        size_t available() { return this->serial_.available(); }
+        void read_array(uint8_t* data, size_t length) { this->serial_.read_array(data, length); }
+        void write_array(const uint8_t* data, size_t length) { this->serial_.write_array(data, length); }
+#else
+        fujitsu_general::airstage::h::EspTimerClock clock_;
+#endif
+        // Constructed in setup(), in place so nothing is allocated
+        std::optional<fujitsu_general::airstage::h::Controller> controller;
+
+        // Requested by control() and published before the indoor unit reports it.
+        // Rolled back to the last reported state if not reported within PendingControlTimeout.
+        static constexpr uint32_t PendingControlTimeout = 10000; // ms
+        struct PendingControl {
+            std::optional<float> TargetTemperature;
+            std::optional<climate::ClimatePreset> Preset;
+            std::optional<climate::ClimateFanMode> FanMode;
+            std::optional<climate::ClimateMode> Mode;
+            std::optional<climate::ClimateSwingMode> SwingMode;
+        };
+        PendingControl pending_control_;
+        fujitsu_general::airstage::h::Config device_config_{};
+        bool have_device_config_{};
 
         void update_from_device(const fujitsu_general::airstage::h::Config& data);
         void update_from_device(const fujitsu_general::airstage::h::Packet& data);
         void update_from_device(const fujitsu_general::airstage::h::Function& data);
         void update_from_controller(const uint8_t address, const fujitsu_general::airstage::h::Config& data);
+        bool update_climate_from_device(const fujitsu_general::airstage::h::Config& data);
+        void roll_back_control();
         void on_initialization_stage(const fujitsu_general::airstage::h::InitializationStageEnum stage);
+        void reset_transport();
+        void publish_statistics();
+        void publish_topology();
+
+        fujitsu_general::airstage::h::ErrorHistory error_history_;
+        ESPPreferenceObject error_history_pref_;
+        uint32_t error_time();
+        void record_error(const fujitsu_general::airstage::h::Packet& data);
+        void publish_error_history();
+
+        fujitsu_general::airstage::h::RuntimeCounters runtime_;
+        ESPPreferenceObject runtime_pref_;
+        void publish_runtime();
+
+        // Errors are counted per minute, independent of diagnostics_interval
+        static constexpr uint32_t BusHealthInterval = 60000; // ms
+        fujitsu_general::airstage::h::BusHealth bus_health_;
+        void publish_bus_health();
+
+        // Main loop iterations, reported per second in the statistics
+        uint32_t loop_count_{};
+        uint32_t statistics_loop_count_{};
+        uint32_t statistics_time_{};
+
+#if !defined(USE_HOST)
+        // Reads the UART driver's events, waking the otherwise disabled loop when bytes arrive
+        QueueHandle_t uart_events_{};
+        TaskHandle_t uart_event_task_{};
+        std::atomic<uint32_t> uart_parity_errors_{};
+        std::atomic<uint32_t> uart_framing_errors_{};
+        std::atomic<uint32_t> uart_overruns_{};
+        static void uart_event_task(void* arg);
+#endif
+
+        std::unique_ptr<fujitsu_general::airstage::h::UnknownBits> unknown_bits_;
+        void dump_unknown_bits();
+        void dump_trace();
+
+        static void format_error_code(char* buf, size_t length, uint8_t address, uint8_t code, uint8_t extended);
 
         void log_buffer(const char* dir, const uint8_t* buf, size_t length);
 
+        // Entities always created with the component
+        static constexpr size_t EntityBytes = 3 * sizeof(binary_sensor::BinarySensor) + 2 * sizeof(text_sensor::TextSensor) + sizeof(sensor::Sensor) +
+            sizeof(custom::CustomButton);
+        size_t entity_bytes() const;
+        size_t ram_footprint() const;
+
         static constexpr climate::ClimateMode mode_to_climate_mode(fujitsu_general::airstage::h::ModeEnum mode) noexcept;
         static constexpr climate::ClimateFanMode fan_speed_to_climate_fan_mode(fujitsu_general::airstage::h::FanSpeedEnum fan_speed) noexcept;
         static constexpr climate::ClimateSwingMode swing_mode_to_climate_swing_mode(bool horizontal, bool vertical) noexcept;
@@ -130,9 +316,12 @@ class FujitsuHalcyonController : public Component, public climate::Climate, publ
         static constexpr fujitsu_general::airstage::h::FanSpeedEnum climate_fan_mode_to_fan_speed(climate::ClimateFanMode fan_speed) noexcept;
         static constexpr std::pair<bool, bool> climate_swing_mode_to_swing_mode(climate::ClimateSwingMode swing_mode) noexcept;
 
+#if !defined(USE_HOST)
+        uart_mode_t uart_mode() const { return this->verify_echo_ ? UART_MODE_UART : UART_MODE_RS485_HALF_DUPLEX; }
         static constexpr uint8_t uart_data_bits_to_uart_config_data_bits(uart_word_length_t bits) noexcept;
         static constexpr uint8_t uart_stop_bits_to_uart_config_stop_bits(uart_stop_bits_t bits) noexcept;
         static constexpr uart::UARTParityOptions uart_parity_to_uart_config_parity(uart_parity_t parity) noexcept;
+#endif
 };
 
 }
@@ -0,0 +1,341 @@
+#pragma once
+
+// Capture file readers shared by the host tools.
+//
+// Supported formats:
+//  - PCAP and PCAPNG containing TZSP (as sent by the component's tzsp option) over UDP/IPv4,
+//    with Ethernet, raw IP or Linux cooked (SLL/SLL2) link layers
+//  - Text, one frame per line: an optional timestamp (seconds with a decimal point, or
+//    [hh:mm:ss.mmm] as in ESPHome logs) followed by 8 hex bytes, optionally preceded by
+//    "RX:" or "TX:"
+//
+// Frames are returned in wire polarity, ready for Packet(Buffer).
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string_view>
+
+#include "Packet.h"
+
+namespace fujitsu_general::airstage::h::capture {
+
+struct Frame {
+    uint64_t Timestamp; // us
+    Packet::Buffer Buffer;
+};
+
+using FrameCallback = std::function<void(const Frame&)>;
+
+class MappedFile {
+    public:
+        explicit MappedFile(const char* path) {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat st {};
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    madvise(data, st.st_size, MADV_SEQUENTIAL);
+                    this->data = { static_cast<const uint8_t*>(data), static_cast<size_t>(st.st_size) };
+                }
+            }
+            close(fd);
+        }
+        ~MappedFile() { if (!this->data.empty()) munmap(const_cast<uint8_t*>(this->data.data()), this->data.size()); }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool is_open() const { return !this->data.empty(); }
+        std::span<const uint8_t> get() const { return this->data; }
+
+    private:
+        std::span<const uint8_t> data;
+};
+
+namespace detail {
+
+constexpr uint16_t TZSPPort = 37008;
+
+inline uint16_t be16(const uint8_t* p) { return p[0] << 8 | p[1]; }
+
+template<typename T>
+inline T read(const uint8_t* p, bool swap) {
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    if (swap) {
+        if constexpr (sizeof(T) == 2)
+            value = __builtin_bswap16(value);
+        else
+            value = __builtin_bswap32(value);
+    }
+    return value;
+}
+
+// Extract the TZSP encapsulated frame from a link layer packet
+inline bool parse_link(uint32_t link_type, std::span<const uint8_t> data, Packet::Buffer& buffer) {
+    size_t offset;
+    uint16_t ether_type = 0x0800;
+
+    switch (link_type) {
+        case 1: // Ethernet
+            if (data.size() < 14)
+                return false;
+            ether_type = be16(&data[12]);
+            offset = 14;
+            if (ether_type == 0x8100 && data.size() >= 18) {
+                ether_type = be16(&data[16]);
+                offset = 18;
+            }
+            break;
+        case 12:
+        case 101:
+        case 228: // Raw IPv4
+            offset = 0;
+            break;
+        case 113: // Linux cooked
+            if (data.size() < 16)
+                return false;
+            ether_type = be16(&data[14]);
+            offset = 16;
+            break;
+        case 276: // Linux cooked v2
+            if (data.size() < 20)
+                return false;
+            ether_type = be16(&data[0]);
+            offset = 20;
+            break;
+        default:
+            return false;
+    }
+
+    // IPv4 / UDP
+    if (ether_type != 0x0800 || data.size() < offset + 20 || (data[offset] >> 4) != 4 || data[offset + 9] != 17)
+        return false;
+    offset += (data[offset] & 0x0F) * 4;
+    if (data.size() < offset + 8 || be16(&data[offset + 2]) != TZSPPort)
+        return false;
+    offset += 8;
+
+    // TZSP header: version, type, encapsulated protocol, then tagged fields
+    if (data.size() < offset + 4 || data[offset] != 1)
+        return false;
+    offset += 4;
+
+    while (offset < data.size()) {
+        auto tag = data[offset++];
+        if (tag == 1) // End
+            break;
+        if (tag == 0) // Padding
+            continue;
+        if (offset >= data.size())
+            return false;
+        offset += 1 + data[offset];
+    }
+
+    if (data.size() - offset != Packet::FrameSize)
+        return false;
+
+    // TZSP carries logical polarity
+    for (size_t i = 0; i < buffer.size(); i++)
+        buffer[i] = ~data[offset + i];
+
+    return true;
+}
+
+inline bool parse_pcap(std::span<const uint8_t> data, const FrameCallback& callback) {
+    if (data.size() < 24)
+        return false;
+
+    auto magic = read<uint32_t>(data.data(), false);
+    bool swap, nanoseconds;
+    switch (magic) {
+        case 0xA1B2C3D4: swap = false; nanoseconds = false; break;
+        case 0xD4C3B2A1: swap = true;  nanoseconds = false; break;
+        case 0xA1B23C4D: swap = false; nanoseconds = true;  break;
+        case 0x4D3CB2A1: swap = true;  nanoseconds = true;  break;
+        default: return false;
+    }
+
+    auto link_type = read<uint32_t>(&data[20], swap) & 0x0FFFFFFF;
+
+    Frame frame;
+    for (size_t offset = 24; offset + 16 <= data.size();) {
+        auto seconds = read<uint32_t>(&data[offset], swap);
+        auto fraction = read<uint32_t>(&data[offset + 4], swap);
+        auto length = read<uint32_t>(&data[offset + 8], swap);
+        offset += 16;
+        if (offset + length > data.size())
+            break;
+
+        if (parse_link(link_type, data.subspan(offset, length), frame.Buffer)) {
+            frame.Timestamp = uint64_t(seconds) * 1000000 + (nanoseconds ? fraction / 1000 : fraction);
+            callback(frame);
+        }
+        offset += length;
+    }
+
+    return true;
+}
+
+inline bool parse_pcapng(std::span<const uint8_t> data, const FrameCallback& callback) {
+    struct Interface {
+        uint32_t link_type;
+        uint64_t units_per_second;
+    };
+
+    Interface interfaces[16] {};
+    size_t interface_count = 0;
+    bool swap = false;
+
+    Frame frame;
+    for (size_t offset = 0; offset + 12 <= data.size();) {
+        auto type = read<uint32_t>(&data[offset], swap);
+
+        // Section header, determines byte order for the section
+        if (type == 0x0A0D0D0A) {
+            if (offset + 12 > data.size())
+                return false;
+            swap = read<uint32_t>(&data[offset + 8], false) != 0x1A2B3C4D;
+            interface_count = 0;
+        }
+
+        auto length = read<uint32_t>(&data[offset + 4], swap);
+        if (length < 12 || offset + length > data.size())
+            break;
+        auto block = data.subspan(offset + 8, length - 12);
+
+        if (type == 1 && block.size() >= 8 && interface_count < std::size(interfaces)) {
+            // Interface description, look for if_tsresol
+            auto& interface = interfaces[interface_count++];
+            interface.link_type = read<uint16_t>(&block[0], swap);
+            interface.units_per_second = 1000000;
+
+            for (size_t option = 8; option + 4 <= block.size();) {
+                auto code = read<uint16_t>(&block[option], swap);
+                auto option_length = read<uint16_t>(&block[option + 2], swap);
+                if (code == 0 || option + 4 + option_length > block.size())
+                    break;
+                if (code == 9 && option_length >= 1) {
+                    auto resolution = block[option + 4];
+                    interface.units_per_second = 1;
+                    for (int i = 0; i < (resolution & 0x7F); i++)
+                        interface.units_per_second *= resolution & 0x80 ? 2 : 10;
+                }
+                option += 4 + ((option_length + 3) & ~3);
+            }
+        }
+        else if (type == 6 && block.size() >= 20) {
+            // Enhanced packet
+            auto interface_id = read<uint32_t>(&block[0], swap);
+            auto captured = read<uint32_t>(&block[12], swap);
+            if (interface_id < interface_count && 20 + captured <= block.size()) {
+                auto& interface = interfaces[interface_id];
+                if (parse_link(interface.link_type, block.subspan(20, captured), frame.Buffer)) {
+                    auto timestamp = uint64_t(read<uint32_t>(&block[4], swap)) << 32 | read<uint32_t>(&block[8], swap);
+                    frame.Timestamp = interface.units_per_second == 1000000 ? timestamp :
+                        static_cast<uint64_t>(static_cast<long double>(timestamp) * 1000000 / interface.units_per_second);
+                    callback(frame);
+                }
+            }
+        }
+
+        offset += length;
+    }
+
+    return true;
+}
+
+inline bool parse_hex_byte(std::string_view& line, uint8_t& value) {
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+        line.remove_prefix(1);
+    if (line.size() < 2 || !std::isxdigit(line[0]) || !std::isxdigit(line[1]))
+        return false;
+
+    auto nibble = [](char c) -> uint8_t { return std::isdigit(c) ? c - '0' : (std::tolower(c) - 'a' + 10); };
+    value = nibble(line[0]) << 4 | nibble(line[1]);
+    line.remove_prefix(2);
+    return true;
+}
+
+inline bool parse_text_line(std::string_view line, Frame& frame, uint64_t& last_timestamp) {
+    // Optional timestamp
+    uint64_t timestamp = last_timestamp;
+    if (!line.empty() && line.front() == '[') {
+        unsigned h, m, s, ms = 0;
+        if (std::sscanf(line.data(), "[%u:%u:%u.%u", &h, &m, &s, &ms) >= 3)
+            timestamp = ((uint64_t(h) * 60 + m) * 60 + s) * 1000000 + ms * 1000;
+    }
+    else {
+        // Seconds, must contain a decimal point to distinguish it from a hex byte
+        double seconds;
+        auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), seconds, std::chars_format::fixed);
+        if (ec == std::errc() && std::memchr(line.data(), '.', end - line.data())) {
+            timestamp = static_cast<uint64_t>(seconds * 1000000);
+            line.remove_prefix(end - line.data());
+        }
+    }
+
+    if (auto pos = line.find("RX:"); pos != std::string_view::npos)
+        line.remove_prefix(pos + 3);
+    else if (auto pos = line.find("TX:"); pos != std::string_view::npos)
+        line.remove_prefix(pos + 3);
+    else if (!line.empty() && line.front() == '[')
+        return false;
+
+    for (auto& b : frame.Buffer) {
+        uint8_t value;
+        if (!parse_hex_byte(line, value))
+            return false;
+        b = ~value;
+    }
+
+    frame.Timestamp = last_timestamp = timestamp;
+    return true;
+}
+
+inline void parse_text(std::span<const uint8_t> data, const FrameCallback& callback) {
+    std::string_view text(reinterpret_cast<const char*>(data.data()), data.size());
+    uint64_t last_timestamp = 0;
+    Frame frame;
+
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto line = text.substr(0, end);
+        text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        if (parse_text_line(line, frame, last_timestamp))
+            callback(frame);
+    }
+}
+
+}
+
+// Calls callback for each frame in data, in capture order
+inline void parse(std::span<const uint8_t> data, const FrameCallback& callback) {
+    if (detail::parse_pcap(data, callback))
+        return;
+
+    if (data.size() >= 4 && detail::read<uint32_t>(data.data(), false) == 0x0A0D0D0A) {
+        detail::parse_pcapng(data, callback);
+        return;
+    }
+
+    detail::parse_text(data, callback);
+}
+
+}
@@ -0,0 +1,473 @@
+// Decodes captures in parallel and reports aggregated bus statistics.
+//
+// Build (Linux):
+//   g++ -std=c++20 -O2 -pthread -Icomponents/fujitsu-halcyon -o fujitsu-halcyon-analyze tools/fujitsu-halcyon-analyze.cpp components/fujitsu-halcyon/Packet.cpp
+//
+// Usage:
+//   fujitsu-halcyon-analyze [options] <capture>...
+//
+//   -f, --format=FORMAT  Output format, csv or json                                   [csv]
+//   -j, --jobs=N         Captures decoded at once                                     [hardware threads]
+//   -p, --per-capture    Also report each capture on its own, e.g. one capture per site
+//   -o, --output=FILE    Statistics output                                            [stdout]
+//
+// Captures are read with Capture.h (PCAP/PCAPNG with TZSP, or text) and decoded with Packet.
+// Each capture is decoded by one thread and the results are merged in argument order, so
+// the output does not depend on the number of jobs.
+//
+// Statistics are (metric, key, value) triples. CSV has one "capture,metric,key,value" row
+// per triple; JSON nests them as {"total": {metric: {key: value}}, "captures": {...}}.
+// Histograms only list non-zero keys.
+//
+//   frames             <source>.<type>     Frames by source (iu, controller) and packet type
+//   addresses          <source>.<address>  Frames by source address
+//   iu_mode            <mode>              IU Config frames by mode, fan speed, setpoint...
+//   iu_fan_speed       <speed>
+//   iu_setpoint        <celsius>
+//   iu_enabled         0, 1
+//   iu_standby         0, 1
+//   iu_error           0, 1
+//   iu_unknown_flags   <value>
+//   controller_temperature  <celsius>      Controller Config frames by reported temperature
+//   controller_writes  <address>           Controller Config frames with the Write flag set
+//   error_codes        <code>.<extended>   IU Error frames, hex
+//   functions          <function>          Function frames, from either source
+//   unknown_bits       <source>.<type>.<byte>.<bit>  Frames with a bit set that Packet does not decode (see UnknownBits.h)
+//   transitions        <field>             Changes between consecutive Config frames of an IU
+//   mode_transitions   <from>.<to>
+//   frame_gap_ms       <bucket>            Time between consecutive frames, 10 ms buckets
+//   token_response_ms  <bucket>            Token passed to a controller until it transmits, 10 ms buckets
+//   rotation_ms        <bucket>            Time between Config frames of an IU, 100 ms buckets
+//   capture            frames, seconds
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Capture.h"
+#include "Packet.h"
+#include "UnknownBits.h"
+
+using namespace fujitsu_general::airstage::h;
+
+namespace {
+
+constexpr size_t GapBuckets = 100;       // 10 ms each, the last collects everything longer
+constexpr size_t RotationBuckets = 100;  // 100 ms each
+constexpr uint64_t MaxGap = 10000000;    // us; longer gaps are capture breaks, not bus timing
+
+constexpr std::array SourceName = { "iu", "controller" };
+constexpr std::array TypeName = { "config", "error", "features", "function", "status", "5", "6", "7" };
+constexpr std::array ModeName = { "0", "fan", "dry", "cool", "heat", "auto", "6", "7" };
+constexpr std::array FanSpeedName = { "auto", "quiet", "low", "medium", "high", "5", "6", "7" };
+constexpr std::array TransitionName = { "enabled", "mode", "fan_speed", "setpoint", "economy", "swing", "standby", "error", "filter" };
+
+using Histogram8 = std::array<uint64_t, 8>;
+
+struct Stats {
+    uint64_t Frames;
+    uint64_t Duration;  // us, sum of spans between frames not counting capture breaks
+
+    std::array<Histogram8, 2> Types;  // By AddressTypeEnum, PacketTypeEnum
+    std::array<std::array<uint64_t, MaxAddress + 1>, 2> Addresses;
+
+    Histogram8 Mode;
+    Histogram8 FanSpeed;
+    Histogram8 UnknownFlags;
+    std::array<uint64_t, 32> Setpoint;
+    std::array<uint64_t, 2> Enabled;
+    std::array<uint64_t, 2> Standby;
+    std::array<uint64_t, 2> Error;
+
+    std::array<uint64_t, 128> ControllerTemperature;  // Half degrees, as on the wire
+    std::array<uint64_t, MaxAddress + 1> ControllerWrites;
+
+    std::array<uint64_t, 256 * 16> ErrorCodes;  // Code << 4 | extended
+    std::array<uint64_t, 256> Functions;
+    std::array<std::array<uint64_t, 64>, 2 * UnknownBits::PacketTypes> Unknown;  // By source * PacketTypes + type, bit
+
+    std::array<uint64_t, TransitionName.size()> Transitions;
+    std::array<Histogram8, 8> ModeTransitions;
+
+    std::array<uint64_t, GapBuckets> FrameGap;
+    std::array<uint64_t, GapBuckets> TokenResponse;
+    std::array<uint64_t, RotationBuckets> Rotation;
+
+    Stats& operator+=(const Stats& other) {
+        auto add = [](auto& a, const auto& b) {
+            for (size_t i = 0; i < std::size(a); i++)
+                if constexpr (std::is_arithmetic_v<std::remove_reference_t<decltype(a[i])>>)
+                    a[i] += b[i];
+                else
+                    for (size_t j = 0; j < std::size(a[i]); j++)
+                        a[i][j] += b[i][j];
+        };
+
+        this->Frames += other.Frames;
+        this->Duration += other.Duration;
+        add(this->Types, other.Types);
+        add(this->Addresses, other.Addresses);
+        add(this->Mode, other.Mode);
+        add(this->FanSpeed, other.FanSpeed);
+        add(this->UnknownFlags, other.UnknownFlags);
+        add(this->Setpoint, other.Setpoint);
+        add(this->Enabled, other.Enabled);
+        add(this->Standby, other.Standby);
+        add(this->Error, other.Error);
+        add(this->ControllerTemperature, other.ControllerTemperature);
+        add(this->ControllerWrites, other.ControllerWrites);
+        add(this->ErrorCodes, other.ErrorCodes);
+        add(this->Functions, other.Functions);
+        add(this->Unknown, other.Unknown);
+        add(this->Transitions, other.Transitions);
+        add(this->ModeTransitions, other.ModeTransitions);
+        add(this->FrameGap, other.FrameGap);
+        add(this->TokenResponse, other.TokenResponse);
+        add(this->Rotation, other.Rotation);
+        return *this;
+    }
+};
+
+template<size_t N>
+void bucket(std::array<uint64_t, N>& histogram, uint64_t value, uint64_t width) {
+    histogram[std::min<uint64_t>(value / width, N - 1)]++;
+}
+
+// Decodes one capture. State carried between frames (previous Config of each IU, pending token)
+// does not cross capture boundaries.
+class Decoder {
+    public:
+        explicit Decoder(Stats& stats) : stats(stats) {}
+
+        void operator()(const capture::Frame& frame) {
+            const Packet packet(frame.Buffer);
+            auto& stats = this->stats;
+            const auto source = static_cast<size_t>(packet.SourceType) & 1;
+            const auto type = static_cast<size_t>(packet.Type) & 7;
+
+            stats.Frames++;
+            stats.Types[source][type]++;
+            stats.Addresses[source][packet.SourceAddress]++;
+
+            uint64_t value = 0;
+            for (size_t i = 0; i < frame.Buffer.size(); i++)
+                value |= uint64_t(static_cast<uint8_t>(~frame.Buffer[i])) << (i * 8);
+            for (auto unknown = value & ~UnknownBits::known_mask(packet.SourceType, packet.Type); unknown; unknown &= unknown - 1)
+                stats.Unknown[source * UnknownBits::PacketTypes + type][std::countr_zero(unknown)]++;
+
+            if (this->have_last && frame.Timestamp >= this->last_time && frame.Timestamp - this->last_time <= MaxGap) {
+                const auto gap = frame.Timestamp - this->last_time;
+                stats.Duration += gap;
+                bucket(stats.FrameGap, gap / 1000, 10);
+
+                if (this->token_controller && packet.SourceType == AddressTypeEnum::Controller && packet.SourceAddress == this->token_address)
+                    bucket(stats.TokenResponse, gap / 1000, 10);
+            }
+            this->have_last = true;
+            this->last_time = frame.Timestamp;
+            this->token_controller = packet.TokenDestinationType == AddressTypeEnum::Controller;
+            this->token_address = packet.TokenDestinationAddress;
+
+            switch (packet.Type) {
+                case PacketTypeEnum::Config:
+                    if (packet.SourceType == AddressTypeEnum::IndoorUnit)
+                        this->indoor_unit_config(packet, frame.Timestamp);
+                    else {
+                        stats.ControllerTemperature[packet.Config.Controller.Temperature.Steps & 127]++;
+                        if (packet.Config.Controller.Write)
+                            stats.ControllerWrites[packet.SourceAddress]++;
+                    }
+                    break;
+
+                case PacketTypeEnum::Error:
+                    if (packet.SourceType == AddressTypeEnum::IndoorUnit)
+                        stats.ErrorCodes[packet.Error.ErrorCode << 4 | (packet.Error.ErrorCodeExtended & 15)]++;
+                    break;
+
+                case PacketTypeEnum::Function:
+                    stats.Functions[packet.Function.Function]++;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+    private:
+        struct Last {
+            struct Config Config;
+            uint64_t Time;
+            bool Valid;
+        };
+
+        Stats& stats;
+        std::array<Last, MaxAddress + 1> last {};
+        uint64_t last_time = 0;
+        bool have_last = false;
+        bool token_controller = false;
+        uint8_t token_address = 0;
+
+        void indoor_unit_config(const Packet& packet, uint64_t time) {
+            auto& stats = this->stats;
+            auto& config = packet.Config;
+            const auto mode = static_cast<size_t>(config.Mode) & 7;
+
+            stats.Mode[mode]++;
+            stats.FanSpeed[static_cast<size_t>(config.FanSpeed) & 7]++;
+            stats.UnknownFlags[config.IndoorUnit.UnknownFlags & 7]++;
+            stats.Setpoint[config.Setpoint & 31]++;
+            stats.Enabled[config.Enabled]++;
+            stats.Standby[config.IndoorUnit.StandbyMode]++;
+            stats.Error[config.IndoorUnit.Error]++;
+
+            auto& last = this->last[packet.SourceAddress];
+            if (last.Valid) {
+                auto& previous = last.Config;
+                const std::array changed = {
+                    config.Enabled != previous.Enabled,
+                    config.Mode != previous.Mode,
+                    config.FanSpeed != previous.FanSpeed,
+                    config.Setpoint != previous.Setpoint,
+                    config.Economy != previous.Economy,
+                    config.SwingVertical != previous.SwingVertical || config.SwingHorizontal != previous.SwingHorizontal,
+                    config.IndoorUnit.StandbyMode != previous.IndoorUnit.StandbyMode,
+                    config.IndoorUnit.Error != previous.IndoorUnit.Error,
+                    config.IndoorUnit.FilterTimerExpired != previous.IndoorUnit.FilterTimerExpired,
+                };
+                static_assert(changed.size() == TransitionName.size());
+
+                for (size_t i = 0; i < changed.size(); i++)
+                    stats.Transitions[i] += changed[i];
+
+                if (changed[1])
+                    stats.ModeTransitions[static_cast<size_t>(previous.Mode) & 7][mode]++;
+
+                if (time >= last.Time && time - last.Time <= MaxGap)
+                    bucket(stats.Rotation, (time - last.Time) / 1000, 100);
+            }
+
+            last = { config, time, true };
+        }
+};
+
+using Emit = std::function<void(const char* metric, const char* key, uint64_t value)>;
+
+void report(const Stats& stats, const Emit& emit) {
+    char key[32];
+    auto histogram = [&](const char* metric, const auto& values, auto name) {
+        for (size_t i = 0; i < std::size(values); i++)
+            if (values[i]) {
+                name(i);
+                emit(metric, key, values[i]);
+            }
+    };
+    auto number = [&](size_t i) { std::snprintf(key, sizeof(key), "%zu", i); };
+    auto buckets = [&](size_t width, size_t count) {
+        return [&key, width, count](size_t i) {
+            std::snprintf(key, sizeof(key), i == count - 1 ? "%zu+" : "%zu", i * width);
+        };
+    };
+
+    for (size_t source = 0; source < stats.Types.size(); source++)
+        histogram("frames", stats.Types[source], [&](size_t i) { std::snprintf(key, sizeof(key), "%s.%s", SourceName[source], TypeName[i]); });
+    for (size_t source = 0; source < stats.Addresses.size(); source++)
+        histogram("addresses", stats.Addresses[source], [&](size_t i) { std::snprintf(key, sizeof(key), "%s.%zu", SourceName[source], i); });
+
+    histogram("iu_mode", stats.Mode, [&](size_t i) { std::snprintf(key, sizeof(key), "%s", ModeName[i]); });
+    histogram("iu_fan_speed", stats.FanSpeed, [&](size_t i) { std::snprintf(key, sizeof(key), "%s", FanSpeedName[i]); });
+    histogram("iu_setpoint", stats.Setpoint, number);
+    histogram("iu_enabled", stats.Enabled, number);
+    histogram("iu_standby", stats.Standby, number);
+    histogram("iu_error", stats.Error, number);
+    histogram("iu_unknown_flags", stats.UnknownFlags, number);
+
+    histogram("controller_temperature", stats.ControllerTemperature, [&](size_t i) { std::snprintf(key, sizeof(key), "%zu.%zu", i / 2, i % 2 * 5); });
+    histogram("controller_writes", stats.ControllerWrites, number);
+
+    histogram("error_codes", stats.ErrorCodes, [&](size_t i) { std::snprintf(key, sizeof(key), "%02zX.%zX", i >> 4, i & 15); });
+    histogram("functions", stats.Functions, number);
+    for (size_t i = 0; i < stats.Unknown.size(); i++)
+        histogram("unknown_bits", stats.Unknown[i], [&](size_t bit) {
+            std::snprintf(key, sizeof(key), "%s.%s.%zu.%zu", SourceName[i / UnknownBits::PacketTypes], TypeName[i % UnknownBits::PacketTypes], bit / 8, bit % 8);
+        });
+
+    histogram("transitions", stats.Transitions, [&](size_t i) { std::snprintf(key, sizeof(key), "%s", TransitionName[i]); });
+    for (size_t from = 0; from < stats.ModeTransitions.size(); from++)
+        histogram("mode_transitions", stats.ModeTransitions[from], [&](size_t i) { std::snprintf(key, sizeof(key), "%s.%s", ModeName[from], ModeName[i]); });
+
+    histogram("frame_gap_ms", stats.FrameGap, buckets(10, GapBuckets));
+    histogram("token_response_ms", stats.TokenResponse, buckets(10, GapBuckets));
+    histogram("rotation_ms", stats.Rotation, buckets(100, RotationBuckets));
+
+    emit("capture", "frames", stats.Frames);
+    emit("capture", "seconds", stats.Duration / 1000000);
+}
+
+void write_csv(FILE* output, std::string_view capture, const Stats& stats) {
+    // Capture paths are the only free text; quote them if needed
+    std::string_view quote = capture.find_first_of(",\"\n") == std::string_view::npos ? "" : "\"";
+    std::string field;
+    for (auto c : capture) {
+        if (c == '"')
+            field += '"';
+        field += c;
+    }
+
+    report(stats, [&](const char* metric, const char* key, uint64_t value) {
+        std::fprintf(output, "%.*s%s%.*s,%s,%s,%" PRIu64 "\n",
+            static_cast<int>(quote.size()), quote.data(), field.c_str(), static_cast<int>(quote.size()), quote.data(), metric, key, value);
+    });
+}
+
+void write_json_string(FILE* output, std::string_view string) {
+    std::fputc('"', output);
+    for (auto c : string) {
+        if (c == '"' || c == '\\')
+            std::fputc('\\', output);
+        if (static_cast<unsigned char>(c) < 0x20)
+            std::fprintf(output, "\\u%04x", c);
+        else
+            std::fputc(c, output);
+    }
+    std::fputc('"', output);
+}
+
+// One metric per line; report() emits the keys of a metric together
+void write_json(FILE* output, const Stats& stats) {
+    const char* metric_open = nullptr;
+
+    std::fputc('{', output);
+    report(stats, [&](const char* metric, const char* key, uint64_t value) {
+        if (metric != metric_open) {
+            std::fprintf(output, "%s\n  \"%s\": {", metric_open ? "}," : "", metric);
+            metric_open = metric;
+        }
+        else
+            std::fputs(", ", output);
+        std::fprintf(output, "\"%s\": %" PRIu64, key, value);
+    });
+    std::fprintf(output, "%s\n}", metric_open ? "}" : "");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    bool per_capture = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    FILE* output = stdout;
+
+    static const option options[] = {
+        { "format",      required_argument, nullptr, 'f' },
+        { "jobs",        required_argument, nullptr, 'j' },
+        { "per-capture", no_argument,       nullptr, 'p' },
+        { "output",      required_argument, nullptr, 'o' },
+        {}
+    };
+
+    for (int opt; (opt = getopt_long(argc, argv, "f:j:po:", options, nullptr)) != -1;) {
+        switch (opt) {
+            case 'f':
+                if (std::strcmp(optarg, "json") == 0)
+                    json = true;
+                else if (std::strcmp(optarg, "csv") != 0) {
+                    std::fprintf(stderr, "%s: unknown format\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'j': jobs = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+            case 'p': per_capture = true; break;
+            case 'o':
+                output = std::fopen(optarg, "w");
+                if (!output) {
+                    std::perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                std::fprintf(stderr, "Usage: %s [-f csv|json] [-j jobs] [-p] [-o output] <capture>...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind >= argc) {
+        std::fprintf(stderr, "Usage: %s [options] <capture>...\n", argv[0]);
+        return 2;
+    }
+
+    const std::vector<const char*> paths(argv + optind, argv + argc);
+    std::vector<Stats> results(paths.size());  // Zero initialized
+    std::vector<uint8_t> readable(paths.size());  // Not vector<bool>, threads write neighbouring elements
+    std::atomic<size_t> next = 0;
+
+    // Files are handed out one at a time, so a few large captures do not leave threads idle at the end
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < paths.size();) {
+            capture::MappedFile file(paths[i]);
+            if (!file.is_open())
+                continue;
+            readable[i] = true;
+
+            Decoder decoder(results[i]);
+            capture::parse(file.get(), std::ref(decoder));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, paths.size()); i++)
+        threads.emplace_back(worker);
+    for (auto& thread : threads)
+        thread.join();
+
+    auto total = std::make_unique<Stats>();
+    int status = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!readable[i]) {
+            std::fprintf(stderr, "%s: unable to read\n", paths[i]);
+            status = 1;
+        }
+        *total += results[i];
+    }
+
+    if (json) {
+        std::fprintf(output, "{\n\"total\": ");
+        write_json(output, *total);
+        if (per_capture) {
+            std::fprintf(output, ",\n\"captures\": {");
+            for (size_t i = 0; i < paths.size(); i++) {
+                std::fprintf(output, "%s\n", i ? "," : "");
+                write_json_string(output, paths[i]);
+                std::fprintf(output, ": ");
+                write_json(output, results[i]);
+            }
+            std::fprintf(output, "\n}");
+        }
+        std::fprintf(output, "\n}\n");
+    }
+    else {
+        std::fprintf(output, "capture,metric,key,value\n");
+        write_csv(output, "total", *total);
+        if (per_capture)
+            for (size_t i = 0; i < paths.size(); i++)
+                write_csv(output, paths[i], results[i]);
+    }
+
+    if (output != stdout)
+        std::fclose(output);
+
+    return status;
+}
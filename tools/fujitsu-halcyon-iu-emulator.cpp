@@ -0,0 +1,189 @@
+// Indoor unit emulator for hardware-in-the-loop testing of controllers.
+//
+// Build (Linux):
+//   g++ -std=c++20 -O2 -Icomponents/fujitsu-halcyon -o fujitsu-halcyon-iu-emulator tools/fujitsu-halcyon-iu-emulator.cpp components/fujitsu-halcyon/HostSerial.cpp components/fujitsu-halcyon/IndoorUnit.cpp components/fujitsu-halcyon/Packet.cpp
+//
+// Usage:
+//   fujitsu-halcyon-iu-emulator [options] <serial port>
+//
+//   -m, --modes=LIST        Supported modes (auto,heat,fan,dry,cool)            [all]
+//   -f, --fan-speeds=LIST   Supported fan speeds (auto,quiet,low,medium,high)    [all]
+//   -x, --extra=LIST        Extra features (filter,sensor,maintenance,economy,vlouver,hlouver)
+//   -e, --error=CODE[.EXT]  Report error CODE (hex) with extended code EXT
+//   -d, --delay=MS          Delay before transmitting after receiving the token  [20]
+//   -j, --jitter=MS         Additional random delay of up to MS                  [0]
+//   -s, --seed=N            Jitter random seed                                   [1]
+//   -v, --verbose           Print every controller frame
+
+#include <getopt.h>
+#include <poll.h>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include "HostSerial.h"
+#include "IndoorUnit.h"
+
+using namespace fujitsu_general::airstage::h;
+
+static volatile std::sig_atomic_t running = true;
+
+static bool parse_list(const char* list, std::initializer_list<std::pair<std::string_view, bool*>> names) {
+    for (auto& name : names)
+        *name.second = false;
+
+    std::string_view remaining(list);
+    while (!remaining.empty()) {
+        auto end = remaining.find(',');
+        auto item = remaining.substr(0, end);
+        remaining = end == std::string_view::npos ? std::string_view() : remaining.substr(end + 1);
+
+        bool found = false;
+        for (auto& name : names)
+            if (name.first == item)
+                found = *name.second = true;
+
+        if (!found) {
+            std::fprintf(stderr, "Unknown value: %.*s\n", static_cast<int>(item.size()), item.data());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void print_frame(const char* dir, const Packet::Buffer& buffer) {
+    std::printf("%s:", dir);
+    for (auto b : buffer)
+        std::printf(" %02X", b ^ 0xFF);
+    std::printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    Features features = {
+        .Mode = { true, true, true, true, true },
+        .FanSpeed = { true, true, true, true, true },
+        .FilterTimer = false,
+        .SensorSwitching = false,
+        .Maintenance = false,
+        .EconomyMode = true,
+        .HorizontalLouvers = false,
+        .VerticalLouvers = false,
+    };
+    unsigned error_code = 0, error_extended = 0;
+    uint32_t delay = 20, jitter = 0, seed = 1;
+    bool verbose = false;
+
+    static const option options[] = {
+        { "modes",      required_argument, nullptr, 'm' },
+        { "fan-speeds", required_argument, nullptr, 'f' },
+        { "extra",      required_argument, nullptr, 'x' },
+        { "error",      required_argument, nullptr, 'e' },
+        { "delay",      required_argument, nullptr, 'd' },
+        { "jitter",     required_argument, nullptr, 'j' },
+        { "seed",       required_argument, nullptr, 's' },
+        { "verbose",    no_argument,       nullptr, 'v' },
+        {}
+    };
+
+    for (int opt; (opt = getopt_long(argc, argv, "m:f:x:e:d:j:s:v", options, nullptr)) != -1;) {
+        bool ok = true;
+        switch (opt) {
+            case 'm':
+                ok = parse_list(optarg, {
+                    { "auto", &features.Mode.Auto }, { "heat", &features.Mode.Heat }, { "fan", &features.Mode.Fan },
+                    { "dry", &features.Mode.Dry }, { "cool", &features.Mode.Cool } });
+                break;
+            case 'f':
+                ok = parse_list(optarg, {
+                    { "auto", &features.FanSpeed.Auto }, { "quiet", &features.FanSpeed.Quiet }, { "low", &features.FanSpeed.Low },
+                    { "medium", &features.FanSpeed.Medium }, { "high", &features.FanSpeed.High } });
+                break;
+            case 'x':
+                ok = parse_list(optarg, {
+                    { "filter", &features.FilterTimer }, { "sensor", &features.SensorSwitching },
+                    { "maintenance", &features.Maintenance }, { "economy", &features.EconomyMode },
+                    { "vlouver", &features.VerticalLouvers }, { "hlouver", &features.HorizontalLouvers } });
+                break;
+            case 'e':
+                ok = std::sscanf(optarg, "%x.%u", &error_code, &error_extended) >= 1 && error_code <= 0xFF && error_extended <= 0x0F;
+                break;
+            case 'd': delay = std::strtoul(optarg, nullptr, 10); break;
+            case 'j': jitter = std::strtoul(optarg, nullptr, 10); break;
+            case 's': seed = std::strtoul(optarg, nullptr, 10); break;
+            case 'v': verbose = true; break;
+            default: ok = false; break;
+        }
+
+        if (!ok) {
+            std::fprintf(stderr, "Usage: %s [-m modes] [-f fan-speeds] [-x extra] [-e code[.ext]] [-d ms] [-j ms] [-s seed] [-v] <serial port>\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        std::fprintf(stderr, "Usage: %s [options] <serial port>\n", argv[0]);
+        return 2;
+    }
+
+    HostSerial serial;
+    if (!serial.open(argv[optind])) {
+        std::perror(argv[optind]);
+        return 1;
+    }
+
+    SteadyClock clock;
+
+    IndoorUnit iu(clock, {
+        .ControllerFrame = {},
+        .AvailableBytes = [&serial]() -> size_t {
+            return serial.available();
+        },
+        .ReadBytes = [&serial, verbose](uint8_t* buf, size_t length) {
+            serial.read_array(buf, length);
+            if (verbose && length == Packet::FrameSize) {
+                Packet::Buffer buffer;
+                std::memcpy(buffer.data(), buf, buffer.size());
+                print_frame("RX", buffer);
+            }
+        },
+        .WriteBytes = [&serial, verbose](const uint8_t* buf, size_t length) {
+            serial.write_array(buf, length);
+            if (verbose) {
+                Packet::Buffer buffer;
+                std::memcpy(buffer.data(), buf, buffer.size());
+                print_frame("TX", buffer);
+            }
+        },
+    });
+
+    Config config {};
+    config.Mode = ModeEnum::Auto;
+    config.Setpoint = 22;
+
+    iu.set_features(features);
+    iu.set_config(config);
+    iu.set_error(error_code, error_extended);
+    iu.set_response_delay(delay);
+    iu.set_jitter(jitter, seed);
+
+    std::signal(SIGINT, [](int) { running = false; });
+    std::signal(SIGTERM, [](int) { running = false; });
+
+    while (running) {
+        pollfd pfd = { .fd = serial.get_fd(), .events = POLLIN, .revents = 0 };
+        poll(&pfd, 1, 2);
+        iu.loop();
+    }
+
+    auto& statistics = iu.get_statistics();
+    std::printf("Rotations: %u, Token timeouts: %u, Writes: %u, Discarded bytes: %u\n", statistics.Rotations, statistics.TokenTimeouts, statistics.Writes, statistics.DiscardedBytes);
+    for (size_t address = 0; address < statistics.ControllerFrames.size(); address++)
+        if (statistics.ControllerFrames[address])
+            std::printf("  Controller %zu: %u frames\n", address, statistics.ControllerFrames[address]);
+
+    return 0;
+}
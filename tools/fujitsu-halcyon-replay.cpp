@@ -0,0 +1,311 @@
+// Replays captured bus traffic through Controller and records everything it does.
+//
+// Build (Linux):
+//   g++ -std=c++20 -O2 -Icomponents/fujitsu-halcyon -o fujitsu-halcyon-replay tools/fujitsu-halcyon-replay.cpp components/fujitsu-halcyon/Controller.cpp components/fujitsu-halcyon/Packet.cpp components/fujitsu-halcyon/Topology.cpp components/fujitsu-halcyon/UnknownBits.cpp
+//
+// Usage:
+//   fujitsu-halcyon-replay [options] <capture>...
+//
+//   -a, --address=N      Controller address to replay as; captured frames from this address are dropped [1]
+//   -l, --listen-only    Replay as a listen only controller (keeps all captured frames)
+//   -n, --no-autoconf    Skip the FeatureRequest probe
+//   -s, --speed=X        Replay speed relative to the capture, 0 for as fast as possible                 [0]
+//   -F, --function-scan  Keep reading every function register of unit 0, as many at once as the queue holds
+//   -S, --split=N        Read only the first N bytes of each frame with it and the rest with the next frame,
+//                        so reads end mid-frame as they can on a host serial port; nothing should be discarded
+//   -w, --write=S        Write the setpoint every S seconds of capture time and report how many of our
+//                        slots passed before each write was sent (1 is the first slot after the request)
+//   -o, --output=FILE    Record of received and transmitted frames and callbacks                         [stdout]
+//
+// The controller must not allocate once constructed. Heap allocations made while it handles frames
+// are counted, and any at all fail the run.
+//
+// Built with -DFUJITSU_HALCYON_TRACING, the controller's hot path stage histograms are reported too.
+//
+// Captures are read with Capture.h (PCAP/PCAPNG with TZSP, or text). Output lines are
+// "<seconds since first frame> <event> <details>" and are stable across runs, so the
+// record of a known good build can be diffed against a new one.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <thread>
+
+#include "Capture.h"
+#include "Controller.h"
+#include "Trace.h"
+
+using namespace fujitsu_general::airstage::h;
+
+namespace {
+
+FILE* output = stdout;
+double now = 0;
+
+// Time follows the capture, so timeouts behave as they did on the bus
+VirtualClock bus_clock;
+uint32_t callbacks = 0;
+uint32_t tx_frames = 0;
+
+// Host time from handing a frame to the controller to it transmitting the reply
+std::chrono::steady_clock::time_point read_time;
+std::chrono::nanoseconds tx_delay {};
+std::chrono::nanoseconds max_tx_delay {};
+
+// Write latency, in our slots and in capture time
+uint32_t writes = 0;
+uint32_t write_tx_frames = 0;
+uint64_t write_time = 0;
+bool write_pending = false;
+uint32_t max_write_slots = 0;
+uint64_t max_write_latency = 0;
+
+// Heap allocations while counting
+bool counting = false;
+uint64_t allocations = 0;
+
+void record(const char* event, const char* format = "", ...) __attribute__((format(printf, 2, 3)));
+
+void record(const char* event, const char* format, ...) {
+    callbacks++;
+    std::fprintf(output, "%.3f %s ", bus_clock.now() / 1e6, event);
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(output, format, args);
+    va_end(args);
+    std::fputc('\n', output);
+}
+
+// Frames are recorded in logical polarity, as captures show them
+void record_frame(const char* direction, const uint8_t* buf, size_t length) {
+    std::fprintf(output, "%.3f %s", bus_clock.now() / 1e6, direction);
+    for (size_t i = 0; i < length; i++)
+        std::fprintf(output, " %02X", buf[i] ^ 0xFF);
+    std::fputc('\n', output);
+}
+
+}
+
+// Every other form of operator new ends up here
+void* operator new(size_t size) {
+    if (counting)
+        allocations++;
+    if (auto p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[]) {
+    uint8_t address = 1;
+    bool listen_only = false;
+    [[maybe_unused]] bool autoconf = true;
+    double speed = 0;
+    bool function_scan = false;
+    size_t split = 0;
+    double write_interval = 0;
+
+    static const option options[] = {
+        { "address",     required_argument, nullptr, 'a' },
+        { "listen-only", no_argument,       nullptr, 'l' },
+        { "no-autoconf", no_argument,       nullptr, 'n' },
+        { "speed",       required_argument, nullptr, 's' },
+        { "function-scan", no_argument,     nullptr, 'F' },
+        { "split",       required_argument, nullptr, 'S' },
+        { "write",       required_argument, nullptr, 'w' },
+        { "output",      required_argument, nullptr, 'o' },
+        {}
+    };
+
+    for (int opt; (opt = getopt_long(argc, argv, "a:lns:FS:w:o:", options, nullptr)) != -1;) {
+        switch (opt) {
+            case 'a': address = std::strtoul(optarg, nullptr, 10) & MaxAddress; break;
+            case 'l': listen_only = true; break;
+            case 'n': autoconf = false; break;
+            case 's': speed = std::strtod(optarg, nullptr); break;
+            case 'F': function_scan = true; break;
+            case 'S': split = std::min<size_t>(std::strtoul(optarg, nullptr, 10), Packet::FrameSize); break;
+            case 'w': write_interval = std::strtod(optarg, nullptr); break;
+            case 'o':
+                output = std::fopen(optarg, "w");
+                if (!output) {
+                    std::perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                std::fprintf(stderr, "Usage: %s [-a address] [-l] [-n] [-s speed] [-F] [-S bytes] [-w seconds] [-o output] <capture>...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind >= argc) {
+        std::fprintf(stderr, "Usage: %s [options] <capture>...\n", argv[0]);
+        return 2;
+    }
+
+    // Fake transport holding at most one frame, plus the held back end of the previous one with --split
+    std::array<uint8_t, 2 * Packet::FrameSize> pending;
+    size_t pending_length = 0;
+    size_t held_back = 0;
+
+    Controller controller(address, bus_clock, {
+        .Config = [](const Config& data) {
+            record("CONFIG", "enabled=%u mode=%u fan=%u setpoint=%u economy=%u swing=%u%u standby=%u error=%u filter=%u",
+                data.Enabled, static_cast<unsigned>(data.Mode), static_cast<unsigned>(data.FanSpeed), data.Setpoint, data.Economy,
+                data.SwingVertical, data.SwingHorizontal, data.IndoorUnit.StandbyMode, data.IndoorUnit.Error, data.IndoorUnit.FilterTimerExpired);
+        },
+        .Error = [](const Packet& data) {
+            record("ERROR", "address=%u code=%02X.%u", data.SourceAddress, data.Error.ErrorCode, data.Error.ErrorCodeExtended);
+        },
+        .Function = [](const Function& data) {
+            record("FUNCTION", "function=%u value=%u unit=%u", data.Function, data.Value, data.Unit);
+        },
+        .ControllerConfig = [](const uint8_t address, const Config& data) {
+            record("CONTROLLER", "address=%u temperature=%.1f write=%u use_sensor=%u", address, data.Controller.Temperature.celsius(), data.Controller.Write, data.Controller.UseControllerSensor);
+        },
+        // As the controller framed it, which with --split shows any misframing
+        .Frame = [](const Packet::Buffer& buffer) {
+            record_frame("RX", buffer.data(), buffer.size());
+        },
+        .InitializationStage = [](const InitializationStageEnum stage) {
+            record("STAGE", "%u", static_cast<unsigned>(stage));
+        },
+        .AvailableBytes = [&]() -> size_t {
+            return pending_length - held_back;
+        },
+        .ReadBytes = [&](uint8_t* buf, size_t length) {
+            std::copy_n(pending.begin(), length, buf);
+            std::copy(pending.begin() + length, pending.begin() + pending_length, pending.begin());
+            pending_length -= length;
+            read_time = std::chrono::steady_clock::now();
+        },
+        .WriteBytes = [](const uint8_t* buf, size_t length) {
+            const auto delay = std::chrono::steady_clock::now() - read_time;
+            tx_delay += delay;
+            max_tx_delay = std::max(max_tx_delay, delay);
+            tx_frames++;
+            if (write_pending && length == Packet::FrameSize) {
+                Packet::Buffer buffer;
+                std::copy_n(buf, buffer.size(), buffer.begin());
+                Packet packet(buffer);
+                if (packet.Type == PacketTypeEnum::Config && packet.Config.Controller.Write) {
+                    write_pending = false;
+                    max_write_slots = std::max(max_write_slots, tx_frames - write_tx_frames);
+                    max_write_latency = std::max(max_write_latency, bus_clock.now() - write_time);
+                }
+            }
+            record_frame("TX", buf, length);
+        },
+        .ResetTransport = []() {
+            record("RESET", "transport");
+        },
+    });
+#if !defined(FUJITSU_HALCYON_FEATURES)
+    controller.set_autoconf(autoconf);
+#endif
+    controller.set_listen_only(listen_only);
+
+    // A full queue, each completion queueing the next function in turn
+    uint8_t next_function = 0;
+    std::function<void()> scan = [&]() {
+        controller.get_function(next_function++, 0, [&](bool, const Function&) { scan(); });
+    };
+    if (function_scan)
+        for (size_t i = 0; i < MaxFunctionRequests; i++)
+            scan();
+    uint64_t next_write = write_interval * 1e6;
+
+    uint64_t frames = 0, dropped = 0;
+    uint64_t first_timestamp = 0;
+    bool first = true;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = optind; i < argc; i++) {
+        capture::MappedFile file(argv[i]);
+        if (!file.is_open()) {
+            std::fprintf(stderr, "%s: unable to read\n", argv[i]);
+            return 1;
+        }
+
+        capture::parse(file.get(), [&](const capture::Frame& frame) {
+            // Everything allocating in here is the controller's
+            counting = true;
+            if (first) {
+                first_timestamp = frame.Timestamp;
+                first = false;
+            }
+            bus_clock.set(frame.Timestamp - first_timestamp);
+            now = bus_clock.now() / 1e6;
+
+            // Our role on the bus is played by the controller under test
+            Packet packet(frame.Buffer);
+            if (!listen_only && packet.SourceType == AddressTypeEnum::Controller && packet.SourceAddress == address) {
+                dropped++;
+                counting = false;
+                return;
+            }
+
+            if (write_interval > 0 && bus_clock.now() >= next_write) {
+                next_write += write_interval * 1e6;
+                if (!write_pending && controller.set_setpoint(writes % 2 ? MinSetpoint : MaxSetpoint)) {
+                    writes++;
+                    write_pending = true;
+                    write_tx_frames = tx_frames;
+                    write_time = bus_clock.now();
+                }
+            }
+
+            if (speed > 0)
+                std::this_thread::sleep_until(start + std::chrono::duration<double>(now / speed));
+
+            std::copy(frame.Buffer.begin(), frame.Buffer.end(), pending.begin() + pending_length);
+            pending_length += frame.Buffer.size();
+            held_back = split ? Packet::FrameSize - split : 0;
+            controller.process_uart_data();
+            counting = false;
+            frames++;
+        });
+    }
+
+    // The end of the last frame
+    held_back = 0;
+    controller.process_uart_data();
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "Replayed %" PRIu64 " frames (%" PRIu64 " dropped) spanning %.1f s in %.3f s: %u TX frames, %u callbacks, %u missed windows, %u initialization timeouts, %u framing errors, %.0f ns/frame\n",
+        frames, dropped, now, elapsed, tx_frames, callbacks, controller.get_statistics().MissedWindows, controller.get_statistics().InitializationTimeouts, controller.get_statistics().FramingErrors, frames ? elapsed * 1e9 / frames : 0.0);
+
+    if (tx_frames)
+        std::fprintf(stderr, "Read to transmit: %.0f ns mean, %.0f ns max\n",
+            static_cast<double>(tx_delay.count()) / tx_frames, static_cast<double>(max_tx_delay.count()));
+
+    std::fprintf(stderr, "Controller: %zu bytes, %" PRIu64 " heap allocations while replaying\n", sizeof(Controller), allocations);
+
+    if (writes)
+        std::fprintf(stderr, "%u writes: at most %u slots, %.3f s from request to transmit%s\n",
+            writes, max_write_slots, max_write_latency / 1e6, write_pending ? " (last not sent)" : "");
+
+#if defined(FUJITSU_HALCYON_TRACING)
+    std::fprintf(stderr, "Trace (%s):\n", trace::Unit);
+    for (size_t stage = 0; stage < static_cast<size_t>(trace::StageEnum::MAX); stage++) {
+        char buf[320];
+        trace::format(static_cast<trace::StageEnum>(stage), buf, sizeof(buf));
+        std::fprintf(stderr, "  %s\n", buf);
+    }
+#endif
+
+    if (output != stdout)
+        std::fclose(output);
+
+    return allocations ? 1 : 0;
+}